@@ -27,6 +27,9 @@
 #include "fb10.h"
 #include "palette.h"
 #include "base.h"
+#include "handler.h"
+#include "pool.h"
+#include "kernel.h"
 
 namespace priv2 {
 namespace base {
@@ -43,11 +46,11 @@ is_base(const char *buf, size_t len)
     return priv2::fb10::is_compressed(buf + PALETTE_SIZE, len - PALETTE_SIZE);
 }
 
-void
-handle_base(const char *buf, size_t len, const std::string &filename_prefix)
+bool
+handle_base(const char *buf, size_t len, const priv2::path::Path &filename_prefix)
 {
     if (!is_base(buf, len)) {
-        priv2::fail("Is not a base file");
+        return priv2::fail("Is not a base file");
     }
 
     constexpr size_t PALETTE_SIZE = 256 * 3;
@@ -55,27 +58,33 @@ handle_base(const char *buf, size_t len, const std::string &filename_prefix)
     int width = 640;
     int height = 480;
 
-    priv2::write_file(buf, PALETTE_SIZE, "%s.pal", filename_prefix.c_str());
+    auto prefix = filename_prefix.str();
+    priv2::write_file(buf, PALETTE_SIZE, "%s.pal", prefix.c_str());
 
     priv2::gfx::Palette pal;
-    pal.raw_from_buffer(buf, PALETTE_SIZE);
+    if (!pal.raw_from_buffer(buf, PALETTE_SIZE)) {
+        return false;
+    }
+
+    priv2::pool::Buffer dec(width * height);
+    if (!priv2::fb10::decompress(buf + PALETTE_SIZE, len - PALETTE_SIZE, *dec)) {
+        return false;
+    }
 
-    auto dec = priv2::fb10::decompress(buf + PALETTE_SIZE, len - PALETTE_SIZE);
-    uint8_t *pixel_ptr = (uint8_t *)dec.data();
+    uint8_t *pixel_ptr = (uint8_t *)dec->data();
 
-    std::vector<char> tmp(width * height * 4);
+    priv2::pool::Buffer tmp(width * height * 4);
+    tmp->resize(width * height * 4);
 
-    for (int y=0; y<height; y++) {
-        uint32_t *write_ptr = (uint32_t *)(tmp.data() + (y * width) * 4);
-        for (int x=0; x<width; x++) {
-            uint8_t value = *pixel_ptr++;
-            uint32_t rgba = pal.lookup(value);
-            *write_ptr++ = rgba;
-        }
-    }
+    uint32_t colors[256];
+    pal.table(colors);
+    priv2::kernel::expand_palette(colors, pixel_ptr, (uint32_t *)tmp->data(), width * height);
 
-    priv2::write_png(tmp.data(), width, height, "%s-base.png", filename_prefix.c_str());
+    return priv2::write_png(tmp->data(), width, height, "%s-base.png", prefix.c_str());
 }
 
+static priv2::handler::Format
+base_format("base", "Handled as base image", 10, is_base, handle_base);
+
 };
 };
@@ -19,14 +19,16 @@
 
 #include <string>
 
+#include "path.h"
+
 namespace priv2 {
 namespace base {
 
 bool
 is_base(const char *buf, size_t len);
 
-void
-handle_base(const char *buf, size_t len, const std::string &filename_prefix);
+bool
+handle_base(const char *buf, size_t len, const priv2::path::Path &filename_prefix);
 
 };
 };
@@ -20,43 +20,155 @@
 #include <string.h>
 #include <stdlib.h>
 
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
 #include <string>
+#include <algorithm>
 
 #include "priv2.h"
+#include "log.h"
+#include "big.h"
 #include "handler.h"
+#include "iff.h"
+#include "task.h"
+#include "shard.h"
+#include "output.h"
+#include "journal.h"
+#include "filter.h"
+#include "unit.h"
 
 namespace {
 
-struct Entry {
-    Entry(uint32_t offset=0, uint32_t length=0, const std::string &filename="")
-        : offset(offset)
-        , length(length)
-        , filename(filename)
-    {
-    }
+constexpr size_t BIG_HEADER_SIZE = 4 * sizeof(uint32_t);
 
-    uint32_t offset;
-    uint32_t length;
-    std::string filename;
-};
+std::string
+lower(const std::string &name)
+{
+    std::string result = name;
+    for (auto &c: result) {
+        c = tolower(c);
+    }
+    return result;
+}
 
 }; // end anonymous namespace
 
 namespace priv2 {
 namespace big {
 
+Index::Index()
+    : fd(-1)
+    , entries()
+    , names()
+{
+}
+
+Index::~Index()
+{
+    if (fd != -1) {
+        close(fd);
+    }
+}
+
+const Entry *
+Index::find(const std::string &name) const
+{
+    auto it = names.find(lower(name));
+    if (it == names.end()) {
+        return nullptr;
+    }
+
+    return &entries[it->second];
+}
+
+std::vector<char>
+Index::read(const Entry &entry) const
+{
+    std::vector<char> result(entry.length);
+    if (pread(fd, result.data(), result.size(), entry.offset) != (ssize_t)result.size()) {
+        priv2::fail(priv2::format("Could not read entry: %s", entry.filename.c_str()));
+    }
+
+    return result;
+}
+
+std::shared_ptr<Index>
+open(const std::string &filename)
+{
+    std::shared_ptr<Index> result(new Index());
+
+    result->fd = ::open(filename.c_str(), O_RDONLY);
+    if (result->fd == -1) {
+        priv2::fail(priv2::format("Could not open file: %s", filename.c_str()));
+    }
+
+    uint32_t header[4];
+    if (pread(result->fd, header, sizeof(header), 0) != sizeof(header) || !is_big((char *)header, sizeof(header))) {
+        return nullptr;
+    }
+
+    uint32_t header_length = priv2::byteswap(header[3]);
+    struct stat st;
+    if (fstat(result->fd, &st) != 0 || header_length < sizeof(header) || header_length > st.st_size) {
+        priv2::fail(priv2::format("Invalid BIG header: %s", filename.c_str()));
+    }
+
+    std::vector<char> directory(header_length);
+    if (pread(result->fd, directory.data(), directory.size(), 0) != (ssize_t)directory.size()) {
+        priv2::fail(priv2::format("Could not read BIG directory: %s", filename.c_str()));
+    }
+
+    result->entries = read_directory(directory.data(), directory.size());
+    for (size_t i=0; i<result->entries.size(); i++) {
+        // First entry wins for duplicate names
+        result->names.emplace(lower(result->entries[i].filename), i);
+    }
+
+    return result;
+}
+
+std::vector<Entry>
+read_directory(const char *buf, size_t len)
+{
+    std::vector<Entry> entries;
+
+    if (len < BIG_HEADER_SIZE) {
+        return entries;
+    }
+
+    uint32_t *header = (uint32_t *)buf;
+    uint32_t n_files = priv2::byteswap(header[2]);
+    uint32_t header_length = priv2::byteswap(header[3]);
+
+    const char *read_ptr = buf + BIG_HEADER_SIZE;
+    const char *end_ptr = buf + std::min<size_t>(std::max<size_t>(header_length, BIG_HEADER_SIZE), len);
+    for (uint32_t i=0; i<n_files && read_ptr + 2 * sizeof(uint32_t) < end_ptr; i++) {
+        uint32_t file_offset = priv2::byteswap(((uint32_t *)read_ptr)[0]);
+        uint32_t file_length = priv2::byteswap(((uint32_t *)read_ptr)[1]);
+        read_ptr += 2 * sizeof(uint32_t);
+
+        size_t filename_len = strnlen(read_ptr, end_ptr - read_ptr);
+        entries.emplace_back(file_offset, file_length, std::string(read_ptr, filename_len));
+        read_ptr += filename_len + 1;
+    }
+
+    return entries;
+}
+
 bool
 is_big(const char *buf, size_t len)
 {
     uint32_t *read_ptr = (uint32_t *)buf;
-    return (len >= 4 && priv2::fourcc(*read_ptr) == "BIGF");
+    return (len >= 4 && priv2::FourCC(*read_ptr) == "BIGF"_cc);
 }
 
-void
-handle_big(const char *buf, size_t len, const std::string &filename_prefix)
+bool
+handle_big(const char *buf, size_t len, const priv2::path::Path &filename_prefix)
 {
     if (!is_big(buf, len)) {
-        priv2::fail("Not a big file");
+        return priv2::fail("Not a big file");
     }
 
     uint32_t *read_ptr = (uint32_t *)buf;
@@ -67,37 +179,81 @@ handle_big(const char *buf, size_t len, const std::string &filename_prefix)
     uint32_t length = priv2::byteswap(*read_ptr++);
     uint32_t n_files = priv2::byteswap(*read_ptr++);
     uint32_t header_length = priv2::byteswap(*read_ptr++);
-    printf("Length: %d bytes, %d files, %d header bytes\n",
+    priv2::log::verbose("Length: %d bytes, %d files, %d header bytes\n",
             length, n_files, header_length);
 
-    std::vector<Entry> entries;
-    for (int i=0; i<n_files; i++) {
-        uint32_t file_offset = priv2::byteswap(*read_ptr++);
-        uint32_t file_length = priv2::byteswap(*read_ptr++);
-        char *filename_str = (char *)read_ptr;
-        entries.emplace_back(file_offset, file_length, std::string(filename_str));
-        while (*filename_str) {
-            filename_str++;
-        }
-        read_ptr = (uint32_t *)(filename_str + 1);
-    }
+    auto entries = read_directory(buf, len);
 
+    // Name of the file for the shard and journal
+    auto key = filename_prefix.flat();
+
+    priv2::task::Group group;
     for (auto &entry: entries) {
-        printf("Entry: offset=%u, length=%u, name='%s'\n",
-                entry.offset, entry.length, entry.filename.c_str());
+        if (!priv2::shard::owns(key, entry.offset)) {
+            continue;
+        }
+
+        auto prefix = filename_prefix.child(entry.filename);
+
+        // Checked before anything of the entry is looked at
+        auto mode = priv2::filter::check(prefix);
+        if (mode == priv2::filter::SKIP) {
+            continue;
+        }
+
+        if (priv2::journal::done(key, entry.offset)) {
+            priv2::log::verbose("Skipping finished entry: '%s'\n", entry.filename.c_str());
+            continue;
+        }
+
+        group.spawn([&, entry, prefix, mode] () {
+            // A failure ends only this entry
+            priv2::unit::run(prefix, entry.offset, [&] () {
+                priv2::log::verbose("Entry: offset=%u, length=%u, name='%s'\n",
+                        entry.offset, entry.length, entry.filename.c_str());
+
+                if (entry.offset > len || entry.length > len - entry.offset) {
+                    priv2::fail("Entry is outside of the BIG file");
+                    return;
+                }
+
+                const char *entry_buf = buf + entry.offset;
+                uint32_t entry_len = entry.length;
 
-        const char *entry_buf = buf + entry.offset;
-        uint32_t entry_len = entry.length;
+                if (priv2::log::enabled(priv2::log::DEBUG)) {
+                    priv2::log::debug("Prefix: '%s'\n", prefix.str().c_str());
+                }
+                if (priv2::handler::handle_data(entry_buf, entry_len, prefix) == priv2::handler::FAILED) {
+                    return;
+                }
 
-        auto prefix = priv2::format("%s-%s", filename_prefix.c_str(), entry.filename.c_str());
-        printf("Prefix: '%s'\n", prefix.c_str());
-        priv2::handler::handle_data(entry_buf, entry_len, prefix);
+                if (mode != priv2::filter::INCLUDE) {
+                    return;
+                }
 
-        // TODO: Also pass to other handlers
+                // TODO: Also pass to other handlers
 
-        priv2::write_file(entry_buf, entry_len, "%s-%s", filename_prefix.c_str(), entry.filename.c_str());
+                auto raw = prefix;
+                if (priv2::big::is_big(entry_buf, entry_len) || priv2::iff::is_iff(entry_buf, entry_len)) {
+                    // In the tree layout, the name of a container is taken by its directory
+                    raw = priv2::path::Path(filename_prefix, entry.filename.c_str(), prefix, entry.filename.c_str());
+                }
+
+                // Copied straight from the input file where possible
+                priv2::output::copy(raw.str(), entry_buf, entry_len);
+
+                priv2::journal::commit(key, entry.offset);
+            });
+        });
     }
+    group.wait();
+
+    // Failures of the entries are their own
+    return true;
 }
 
+static priv2::handler::Format
+big_format("big", "Handled as BIG archive", priv2::handler::Format::CONTAINER, "BIGF"_cc, is_big, handle_big);
+
 };
 };
@@ -17,16 +17,66 @@
 
 #pragma once
 
+#include <cstdint>
 #include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+
+#include "path.h"
 
 namespace priv2 {
 namespace big {
 
+struct Entry {
+    Entry(uint32_t offset=0, uint32_t length=0, const std::string &filename="")
+        : offset(offset)
+        , length(length)
+        , filename(filename)
+    {
+    }
+
+    uint32_t offset;
+    uint32_t length;
+    std::string filename;
+};
+
+/**
+ * Random access to the entries of a BIG file. Only the header and the
+ * directory are read, and each entry is fetched with a single pread(),
+ * so getting one entry out of a large archive does not load all of it.
+ **/
+struct Index {
+    Index();
+    ~Index();
+
+    // Look up an entry by name (case-insensitive), nullptr if not found
+    const Entry *find(const std::string &name) const;
+
+    std::vector<char> read(const Entry &entry) const;
+
+    int fd;
+    std::vector<Entry> entries;
+
+    // Lower-case entry name -> index in "entries"
+    std::unordered_map<std::string, size_t> names;
+};
+
+/**
+ * Open a BIG file for random access, returns nullptr if it is not one.
+ **/
+std::shared_ptr<Index> open(const std::string &filename);
+
+/**
+ * Parse the directory of a BIG file, <buf> holds the first <len> bytes.
+ **/
+std::vector<Entry> read_directory(const char *buf, size_t len);
+
 bool
 is_big(const char *buf, size_t len);
 
-void
-handle_big(const char *buf, size_t len, const std::string &filename_prefix);
+bool
+handle_big(const char *buf, size_t len, const priv2::path::Path &filename_prefix);
 
 };
 };
@@ -0,0 +1,325 @@
+/*
+ * Privateer 2: The Darkening -- Data Dumper
+ * Copyright (c) 2016, 2017, Thomas Perl
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "cache.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <thread>
+
+#include "priv2.h"
+#include "log.h"
+#include "output.h"
+#include "stats.h"
+#include "unit.h"
+
+namespace {
+
+// Bump whenever a decoder changes its output (or the format of the entries
+// changes), so that old entries are not used
+constexpr int CACHE_VERSION = 2;
+
+constexpr uint32_t CACHE_MAGIC = 0x32433250; // "P2C2"
+
+// Entry header: magic, number of files, input length and check hash
+constexpr long COUNT_OFFSET = sizeof(uint32_t);
+
+// Seeds of the hash in the name of an entry, and of the one in its header
+constexpr uint64_t KEY_SEED = 0x5032444d50ull;
+constexpr uint64_t CHECK_SEED = 0x4b43454843ull;
+
+std::string
+cache_directory;
+
+thread_local priv2::cache::Recorder *
+current_recorder = nullptr;
+
+priv2::stats::Counter
+cache_hits("Cache hits");
+
+priv2::stats::Counter
+cache_misses("Cache misses");
+
+priv2::stats::Counter
+cache_bytes_saved("Cache input bytes not decoded (hits)");
+
+priv2::stats::Counter
+cache_bytes_reused("Cache output bytes reused (hits)");
+
+/**
+ * MurmurHash64A by Austin Appleby (public domain)
+ **/
+uint64_t
+hash(const char *buf, size_t len, uint64_t seed)
+{
+    const uint64_t m = 0xc6a4a7935bd1e995ull;
+    const int r = 47;
+
+    uint64_t h = seed ^ (len * m);
+
+    const char *end = buf + (len / 8) * 8;
+    while (buf != end) {
+        uint64_t k;
+        memcpy(&k, buf, sizeof(k));
+        buf += sizeof(k);
+
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+
+        h ^= k;
+        h *= m;
+    }
+
+    const unsigned char *tail = (const unsigned char *)buf;
+    switch (len & 7) {
+        case 7: h ^= uint64_t(tail[6]) << 48; // fall through
+        case 6: h ^= uint64_t(tail[5]) << 40; // fall through
+        case 5: h ^= uint64_t(tail[4]) << 32; // fall through
+        case 4: h ^= uint64_t(tail[3]) << 24; // fall through
+        case 3: h ^= uint64_t(tail[2]) << 16; // fall through
+        case 2: h ^= uint64_t(tail[1]) << 8; // fall through
+        case 1: h ^= uint64_t(tail[0]);
+                h *= m;
+    }
+
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+
+    return h;
+}
+
+bool
+read_value(FILE *fp, void *value, size_t size)
+{
+    return fread(value, size, 1, fp) == 1;
+}
+
+/**
+ * Read the cache entry of the input with the given length and check hash,
+ * and submit its files. Returns false if there is no (valid) entry for
+ * that input, nothing is submitted in that case.
+ **/
+bool
+replay(const std::string &filename, uint64_t len, uint64_t check, const priv2::path::Path &path)
+{
+    FILE *fp = fopen(filename.c_str(), "rb");
+    if (!fp) {
+        return false;
+    }
+
+    std::vector<std::pair<std::string, std::vector<char>>> files;
+
+    uint32_t magic = 0;
+    uint32_t count = 0;
+    uint64_t entry_len = 0;
+    uint64_t entry_check = 0;
+    bool ok = read_value(fp, &magic, sizeof(magic)) && magic == CACHE_MAGIC &&
+              read_value(fp, &count, sizeof(count)) &&
+              read_value(fp, &entry_len, sizeof(entry_len)) &&
+              read_value(fp, &entry_check, sizeof(entry_check));
+
+    if (ok && (entry_len != len || entry_check != check)) {
+        // The name hash collided with that of other data
+        priv2::log::verbose("Cache entry is for other data: %s\n", filename.c_str());
+        fclose(fp);
+        return false;
+    }
+
+    for (uint32_t i=0; ok && i<count; i++) {
+        uint32_t name_len;
+        uint64_t data_len;
+        std::string name;
+        std::vector<char> data;
+
+        ok = read_value(fp, &name_len, sizeof(name_len));
+        if (ok) {
+            name.resize(name_len);
+            ok = (name_len == 0 || read_value(fp, &name[0], name_len)) &&
+                 read_value(fp, &data_len, sizeof(data_len));
+        }
+        if (ok) {
+            data.resize(data_len);
+            ok = (data_len == 0 || read_value(fp, data.data(), data_len));
+        }
+        if (ok) {
+            files.emplace_back(name, std::move(data));
+        }
+    }
+
+    fclose(fp);
+
+    if (!ok) {
+        priv2::log::warning("Ignoring broken cache entry: %s\n", filename.c_str());
+        return false;
+    }
+
+    for (auto &file: files) {
+        cache_bytes_reused.add(file.second.size());
+        priv2::output::submit(path.str() + file.first, std::move(file.second));
+    }
+
+    return true;
+}
+
+/**
+ * Start a new cache entry in <tmp_filename> (the files are appended by
+ * the recorder). Returns nullptr if it can't be written.
+ **/
+FILE *
+create(const std::string &tmp_filename, uint64_t len, uint64_t check)
+{
+    FILE *fp = fopen(tmp_filename.c_str(), "wb");
+    if (!fp) {
+        return nullptr;
+    }
+
+    // The number of files is filled in when the entry is stored
+    uint32_t magic = CACHE_MAGIC;
+    uint32_t count = 0;
+    fwrite(&magic, sizeof(magic), 1, fp);
+    fwrite(&count, sizeof(count), 1, fp);
+    fwrite(&len, sizeof(len), 1, fp);
+    fwrite(&check, sizeof(check), 1, fp);
+    return fp;
+}
+
+/**
+ * Finish the entry written by <recorder> and move it into place under
+ * <filename>, or throw it away if <keep> is false.
+ **/
+void
+store(const std::string &tmp_filename, const std::string &filename, priv2::cache::Recorder &recorder, bool keep)
+{
+    FILE *fp = recorder.fp;
+    bool ok = keep && fseek(fp, COUNT_OFFSET, SEEK_SET) == 0 &&
+              fwrite(&recorder.count, sizeof(recorder.count), 1, fp) == 1 && !ferror(fp);
+
+    if (fclose(fp) != 0 || !ok || rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+        if (keep) {
+            priv2::log::warning("Could not write cache entry: %s\n", filename.c_str());
+        }
+        remove(tmp_filename.c_str());
+    }
+}
+
+}; // end anonymous namespace
+
+namespace priv2 {
+namespace cache {
+
+void
+open(const std::string &directory)
+{
+    if (mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST) {
+        priv2::fail(priv2::format("Could not create cache directory: %s", directory.c_str()));
+    }
+
+    cache_directory = directory;
+}
+
+void
+Recorder::add(const std::string &filename, const std::vector<char> &data)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (!valid) {
+        return;
+    }
+
+    if (filename.compare(0, prefix.size(), prefix) != 0) {
+        // Output not named after the prefix, can't be replayed elsewhere
+        valid = false;
+        return;
+    }
+
+    uint32_t name_len = filename.size() - prefix.size();
+    uint64_t data_len = data.size();
+    fwrite(&name_len, sizeof(name_len), 1, fp);
+    fwrite(filename.data() + prefix.size(), name_len, 1, fp);
+    fwrite(&data_len, sizeof(data_len), 1, fp);
+    fwrite(data.data(), data_len, 1, fp);
+    count++;
+}
+
+Recorder *
+current()
+{
+    return current_recorder;
+}
+
+Recorder *
+swap(Recorder *recorder)
+{
+    Recorder *previous = current_recorder;
+    current_recorder = recorder;
+    return previous;
+}
+
+bool
+run(const char *kind, const char *buf, size_t len, const priv2::path::Path &path, std::function<bool()> fn)
+{
+    if (cache_directory.empty()) {
+        return fn();
+    }
+
+    auto filename = priv2::format("%s/%016llx-%zx-%s-v%d", cache_directory.c_str(),
+            (unsigned long long)hash(buf, len, KEY_SEED), len, kind, CACHE_VERSION);
+
+    // Checked before an entry is used, the name alone may collide
+    uint64_t check = hash(buf, len, CHECK_SEED);
+
+    if (replay(filename, len, check, path)) {
+        priv2::log::verbose("Cache hit: %s\n", filename.c_str());
+        cache_hits.add(1);
+        cache_bytes_saved.add(len);
+        return true;
+    }
+
+    cache_misses.add(1);
+
+    // Written to a temporary file first, so that concurrent runs never see
+    // a partial entry
+    std::string tmp_filename = priv2::format("%s.%d.%zx.tmp", filename.c_str(), (int)getpid(),
+            std::hash<std::thread::id>()(std::this_thread::get_id()));
+    FILE *fp = create(tmp_filename, len, check);
+    if (!fp) {
+        priv2::log::warning("Could not write cache entry: %s\n", filename.c_str());
+    }
+
+    Recorder recorder(path.str(), fp);
+    Recorder *previous = swap(&recorder);
+    bool ok = fn();
+    swap(previous);
+
+    if (fp) {
+        // Outputs of a failed decoder (or of its tasks) are incomplete
+        store(tmp_filename, filename, recorder, ok && recorder.valid && !priv2::unit::failed());
+    }
+
+    return ok;
+}
+
+};
+};
@@ -0,0 +1,77 @@
+/*
+ * Privateer 2: The Darkening -- Data Dumper
+ * Copyright (c) 2016, 2017, Thomas Perl
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <functional>
+
+#include <cstdio>
+#include <cstdint>
+
+#include "path.h"
+
+namespace priv2 {
+namespace cache {
+
+/**
+ * Use the given directory as decode cache (--cache). Entries are keyed by
+ * a hash of the input bytes and the kind of decoder, and hold the output
+ * files the decoder produced, relative to its filename prefix.
+ **/
+void open(const std::string &directory);
+
+/**
+ * Writes the output files submitted while a decoder runs (including the
+ * tasks it spawns) to the temporary file of a new cache entry as they
+ * come, so that no copies of them are held in memory (--mem-limit).
+ **/
+struct Recorder {
+    Recorder(const std::string &prefix, FILE *fp) : prefix(prefix), mutex(), fp(fp), count(0), valid(fp != nullptr) {}
+
+    void add(const std::string &filename, const std::vector<char> &data);
+
+    std::string prefix;
+    std::mutex mutex;
+    FILE *fp;
+    uint32_t count;
+    bool valid;
+};
+
+/**
+ * Get the recorder active on the calling thread, or nullptr.
+ **/
+Recorder *current();
+
+/**
+ * Make the given recorder the active one on the calling thread, and return
+ * the previously active one.
+ **/
+Recorder *swap(Recorder *recorder);
+
+/**
+ * Run the decoder <fn> of the given kind for <buf>, unless its outputs
+ * are already in the cache, in which case they are written out instead.
+ * The decoder must have finished all of its tasks when it returns, and
+ * returns false if it failed. Returns what <fn> returned (true on hits).
+ **/
+bool run(const char *kind, const char *buf, size_t len, const priv2::path::Path &path, std::function<bool()> fn);
+
+};
+};
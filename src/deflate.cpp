@@ -27,14 +27,33 @@ namespace deflate {
 bool
 is_compressed(char *buf, size_t len)
 {
-    return (len >= 4 && priv2::fourcc(*((uint32_t *)buf)) == "Def!");
+    return (len >= 4 && priv2::FourCC(*((uint32_t *)buf)) == "Def!"_cc);
+}
+
+uint32_t
+uncompressed_size(char *buf, size_t len)
+{
+    if (!is_compressed(buf, len) || len < 8) {
+        return 0;
+    }
+
+    // After "Def!"
+    return *((uint32_t *)buf + 1);
 }
 
 std::vector<char>
 decompress(char *buf, size_t len)
+{
+    std::vector<char> result;
+    decompress(buf, len, result);
+    return result;
+}
+
+bool
+decompress(char *buf, size_t len, std::vector<char> &result)
 {
     if (!is_compressed(buf, len)) {
-        priv2::fail("Not compressed");
+        return priv2::fail("Not compressed");
     }
 
     uint32_t *read_ptr = (uint32_t *)buf;
@@ -44,14 +63,14 @@ decompress(char *buf, size_t len)
     uint32_t uncompressed_size = *read_ptr++;
     uint32_t compressed_size = *read_ptr++;
 
-    std::vector<char> result(uncompressed_size);
+    result.resize(uncompressed_size);
     unsigned long tmp_len = result.size();
 
     if (::uncompress((unsigned char *)result.data(), &tmp_len, (unsigned char *)(read_ptr), compressed_size) != Z_OK) {
-        priv2::fail("Could not decompress");
+        return priv2::fail("Could not decompress");
     }
 
-    return result;
+    return true;
 }
 
 };
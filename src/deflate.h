@@ -19,14 +19,23 @@
 
 #include <vector>
 
+#include <cstdint>
+#include <cstddef>
+
 namespace priv2 {
 namespace deflate {
 
 bool
 is_compressed(char *buf, size_t len);
 
+uint32_t
+uncompressed_size(char *buf, size_t len);
+
 std::vector<char>
 decompress(char *buf, size_t len);
 
+bool
+decompress(char *buf, size_t len, std::vector<char> &out);
+
 };
 };
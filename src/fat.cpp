@@ -21,15 +21,21 @@
 #include <stdlib.h>
 #include <sndfile.h>
 
+#include <vector>
 #include <string>
 
 #include "priv2.h"
+#include "log.h"
 #include "fat.h"
+#include "handler.h"
+#include "task.h"
+#include "output.h"
 
 namespace {
 
+// Called back from libsndfile: errors are kept, and fail the unit once it returned
 struct VirtualIO {
-    VirtualIO(const char *buf, size_t len) : buf(buf), len(len), pos(0) {}
+    VirtualIO(const char *buf, size_t len) : buf(buf), len(len), pos(0), error(nullptr) {}
 
     size_t get_filelen() { return len; }
 
@@ -45,7 +51,7 @@ struct VirtualIO {
             case SEEK_CUR:
                 pos = pos + offset;
             default:
-                priv2::fail("Invalid seek");
+                error = "Invalid seek";
                 break;
 
         }
@@ -66,7 +72,7 @@ struct VirtualIO {
 
     size_t write(const void *, size_t size)
     {
-        priv2::fail("Write not supported");
+        error = "Write not supported";
         return 0;
     }
 
@@ -75,6 +81,7 @@ struct VirtualIO {
     const char *buf;
     size_t len;
     size_t pos;
+    const char *error;
 };
 
 static sf_count_t
@@ -116,6 +123,101 @@ VirtualIO_SoundFileVtable = {
     VirtualIO_sf_vio_tell,
 };
 
+// Room for the header of the WAV files written by libsndfile
+constexpr size_t WAV_HEADER_SIZE = 1024;
+
+struct MemoryIO {
+    MemoryIO() : data(), pos(0), error(nullptr) {}
+
+    size_t get_filelen() { return data.size(); }
+
+    size_t seek(size_t offset, int whence)
+    {
+        switch (whence) {
+            case SEEK_SET:
+                pos = 0 + offset;
+                break;
+            case SEEK_END:
+                pos = data.size() + offset;
+                break;
+            case SEEK_CUR:
+                pos = pos + offset;
+                break;
+            default:
+                error = "Invalid seek";
+                break;
+        }
+
+        return pos;
+    }
+
+    size_t read(char *buf, size_t size)
+    {
+        size_t available = (pos < data.size()) ? (data.size() - pos) : 0;
+        if (available < size) {
+            size = available;
+        }
+        memcpy(buf, data.data() + pos, size);
+        pos += size;
+        return size;
+    }
+
+    size_t write(const void *buf, size_t size)
+    {
+        if (pos + size > data.size()) {
+            data.resize(pos + size);
+        }
+        memcpy(data.data() + pos, buf, size);
+        pos += size;
+        return size;
+    }
+
+    size_t tell() { return pos; }
+
+    std::vector<char> data;
+    size_t pos;
+    const char *error;
+};
+
+static sf_count_t
+MemoryIO_sf_vio_get_filelen(void *user_data)
+{
+    return static_cast<MemoryIO *>(user_data)->get_filelen();
+}
+
+static sf_count_t
+MemoryIO_sf_vio_seek(sf_count_t offset, int whence, void *user_data)
+{
+    return static_cast<MemoryIO *>(user_data)->seek(offset, whence);
+}
+
+static sf_count_t
+MemoryIO_sf_vio_read(void *ptr, sf_count_t count, void *user_data)
+{
+    return static_cast<MemoryIO *>(user_data)->read((char *)ptr, count);
+}
+
+static sf_count_t
+MemoryIO_sf_vio_write(const void *ptr, sf_count_t count, void *user_data)
+{
+    return static_cast<MemoryIO *>(user_data)->write(ptr, count);
+}
+
+static sf_count_t
+MemoryIO_sf_vio_tell(void *user_data)
+{
+    return static_cast<MemoryIO *>(user_data)->tell();
+}
+
+static SF_VIRTUAL_IO
+MemoryIO_SoundFileVtable = {
+    MemoryIO_sf_vio_get_filelen,
+    MemoryIO_sf_vio_seek,
+    MemoryIO_sf_vio_read,
+    MemoryIO_sf_vio_write,
+    MemoryIO_sf_vio_tell,
+};
+
 struct SoundChunk {
     enum EncodingFormat {
         ENCODING_PCM_16_BIT = 0x00,
@@ -158,7 +260,6 @@ struct SoundChunk {
         switch (flags[FLAG_ENCODING_FORMAT]) {
             case ENCODING_PCM_16_BIT: return "16-bit PCM  ";
             case ENCODING_ADPCM:      return " 4-bit ADPCM";
-            default: priv2::fail(priv2::format("Unknown encoding format: 0x%02x", flags[FLAG_ENCODING_FORMAT]));
         }
 
         return nullptr;
@@ -170,7 +271,6 @@ struct SoundChunk {
             case SAMPLE_RATE_11KHZ: return 11025;
             case SAMPLE_RATE_22KHZ: return 22050;
             case SAMPLE_RATE_16KHZ: return 16000;
-            default: priv2::fail(priv2::format("Unknown samplerate flag: 0x%02x", flags[FLAG_SAMPLE_RATE]));
         }
 
         return 0;
@@ -186,7 +286,6 @@ struct SoundChunk {
         switch (flags[FLAG_ENCODING_FORMAT]) {
             case ENCODING_PCM_16_BIT: return uncompressed_size;
             case ENCODING_ADPCM: return total_samples() / 2;
-            default: priv2::fail(priv2::format("Unknown encoding format: 0x%02x", flags[FLAG_ENCODING_FORMAT]));
         }
 
         return 0;
@@ -206,14 +305,14 @@ bool
 is_sound(const char *buf, size_t len)
 {
     uint32_t *read_ptr = (uint32_t *)buf;
-    return (priv2::fourcc(*read_ptr) == "1.00");
+    return (priv2::FourCC(*read_ptr) == "1.00"_cc);
 }
 
-void
-decode_sound(const char *buf, size_t len, const std::string &filename_prefix)
+bool
+decode_sound(const char *buf, size_t len, const priv2::path::Path &filename_prefix)
 {
     if (!is_sound(buf, len)) {
-        priv2::fail("Not a sound");
+        return priv2::fail("Not a sound");
     }
 
     // layout:
@@ -247,7 +346,7 @@ decode_sound(const char *buf, size_t len, const std::string &filename_prefix)
     // unk1=0x00010101
 
     uint32_t number_of_items = *read_ptr++;
-    printf("File size: %d, number of sounds in file: %d\n", (int)len, number_of_items);
+    priv2::log::verbose("File size: %d, number of sounds in file: %d\n", (int)len, number_of_items);
 
     std::vector<SoundChunk> sounds;
     for (int i=0; i<number_of_items; i++) {
@@ -280,9 +379,14 @@ decode_sound(const char *buf, size_t len, const std::string &filename_prefix)
         sounds.emplace_back(offset, uncompressed_size, flags);
     }
 
+    priv2::task::Group group;
+
+    // Rendered once for the names of all sounds
+    auto prefix = filename_prefix.str();
+
     int i = 0;
     for (auto &sound: sounds) {
-        auto output_filename = priv2::format("%s-snd%d.wav", filename_prefix.c_str(), i);
+        auto output_filename = priv2::format("%s-snd%d.wav", prefix.c_str(), i);
 
         // This is the only file with sound.flags[6] == 0x01
         // Prefix: 'SPEECH.BIG-W15_5A.fat' (German Privateer 2)
@@ -292,60 +396,94 @@ decode_sound(const char *buf, size_t len, const std::string &filename_prefix)
         if (sound.flags[6] == 0x01) {
             sound.flags[6] = 0x00;
             if (sound.flags[SoundChunk::FLAG_SAMPLE_RATE] == SoundChunk::SAMPLE_RATE_11KHZ) {
-                printf("Fixing up sampling rate -> 11kHz->22kHz (flags[6] == 0x01) !! THIS IS A HACK !!\n");
+                priv2::log::info("Fixing up sampling rate -> 11kHz->22kHz (flags[6] == 0x01) !! THIS IS A HACK !!\n");
                 sound.flags[SoundChunk::FLAG_SAMPLE_RATE] = SoundChunk::SAMPLE_RATE_22KHZ;
             } else {
-                printf("WARNING: Do not know how to handle this yet, please report: %s\n",
+                priv2::log::warning("Do not know how to handle this yet, please report: %s\n",
                         output_filename.c_str());
             }
         }
 
         if (sound.flags[2] != 0x00 || sound.flags[3] != 0x00 || sound.flags[4] != 0x00 || sound.flags[5] != 0x01 ||
                 sound.flags[6] != 0x00 || sound.flags[7] != 0x01) {
-            priv2::fail(priv2::format("Sound %d: Unexpected mid flags=[%02x %02x %02x %02x %02x %02x]",
+            return priv2::fail(priv2::format("Sound %d: Unexpected mid flags=[%02x %02x %02x %02x %02x %02x]",
                    i,
                    sound.flags[2], sound.flags[3], sound.flags[4],
                    sound.flags[5], sound.flags[6], sound.flags[7]));
         }
 
         if (sound.flags[0] != 0x00 && sound.flags[0] != 0x01) {
-            priv2::fail(priv2::format("Sound %d: Unexpected flags[0]=%02x", i, sound.flags[0]));
+            return priv2::fail(priv2::format("Sound %d: Unexpected flags[0]=%02x", i, sound.flags[0]));
+        }
+
+        if (sound.get_encoding_name() == nullptr) {
+            return priv2::fail(priv2::format("Unknown encoding format: 0x%02x",
+                        sound.flags[SoundChunk::FLAG_ENCODING_FORMAT]));
         }
 
-        printf("Sound %4d: off=0x%08x size=%6d encoding=%s flags=[%02x] rate=%d samples=%d -> %s\n",
+        if (sound.get_samplerate() == 0) {
+            return priv2::fail(priv2::format("Unknown samplerate flag: 0x%02x",
+                        sound.flags[SoundChunk::FLAG_SAMPLE_RATE]));
+        }
+
+        priv2::log::info("Sound %4d: off=0x%08x size=%6d encoding=%s flags=[%02x] rate=%d samples=%d -> %s\n",
                i, sound.offset, sound.uncompressed_size, sound.get_encoding_name(), sound.flags[1],
                sound.get_samplerate(), sound.total_samples(), output_filename.c_str());
 
         //priv2::write_file(buf + sound.offset, sound.compressed_size(), "%s.pcm", output_filename.c_str());
 
-        VirtualIO vio(buf + sound.offset, sound.compressed_size());
-
-        SF_INFO ininfo;
-        memset(&ininfo, 0, sizeof(ininfo));
-        ininfo.samplerate = sound.get_samplerate();
-        ininfo.channels = 1;
-        ininfo.format = SF_FORMAT_RAW | (sound.is_adpcm() ? SF_FORMAT_VOX_ADPCM : SF_FORMAT_PCM_16) | SF_ENDIAN_LITTLE;
-        SNDFILE *insnd = sf_open_virtual(&VirtualIO_SoundFileVtable, SFM_READ, &ininfo, &vio);
-
-        SF_INFO outinfo;
-        memset(&outinfo, 0, sizeof(outinfo));
-        outinfo.samplerate = ininfo.samplerate;
-        outinfo.channels = ininfo.channels;
-        outinfo.format = SF_FORMAT_WAV | SF_FORMAT_PCM_16 | SF_ENDIAN_FILE;
-        SNDFILE *outsnd = sf_open(output_filename.c_str(), SFM_WRITE, &outinfo);
-
-        std::vector<short> samples(1024);
-        size_t count = 0;
-        while ((count = sf_read_short(insnd, samples.data(), samples.size())) != 0) {
-            sf_write_short(outsnd, samples.data(), count);
-        }
+        // Peak memory (--mem-limit): the WAV file with its 16-bit samples, which
+        // is reserved up front so that growing it does not double its capacity
+        size_t wav_size = WAV_HEADER_SIZE + sound.total_samples() * sizeof(short);
+        group.spawn([buf, &sound, output_filename, wav_size] () {
+            VirtualIO vio(buf + sound.offset, sound.compressed_size());
+
+            SF_INFO ininfo;
+            memset(&ininfo, 0, sizeof(ininfo));
+            ininfo.samplerate = sound.get_samplerate();
+            ininfo.channels = 1;
+            ininfo.format = SF_FORMAT_RAW | (sound.is_adpcm() ? SF_FORMAT_VOX_ADPCM : SF_FORMAT_PCM_16) | SF_ENDIAN_LITTLE;
+            SNDFILE *insnd = sf_open_virtual(&VirtualIO_SoundFileVtable, SFM_READ, &ininfo, &vio);
+
+            SF_INFO outinfo;
+            memset(&outinfo, 0, sizeof(outinfo));
+            outinfo.samplerate = ininfo.samplerate;
+            outinfo.channels = ininfo.channels;
+            outinfo.format = SF_FORMAT_WAV | SF_FORMAT_PCM_16 | SF_ENDIAN_FILE;
+
+            // Encode to memory, the file is written by the output writer
+            MemoryIO wav;
+            wav.data.reserve(wav_size);
+            SNDFILE *outsnd = sf_open_virtual(&MemoryIO_SoundFileVtable, SFM_WRITE, &outinfo, &wav);
+
+            std::vector<short> samples(1024);
+            size_t count = 0;
+            while ((count = sf_read_short(insnd, samples.data(), samples.size())) != 0) {
+                sf_write_short(outsnd, samples.data(), count);
+            }
 
-        sf_close(outsnd);
-        sf_close(insnd);
+            sf_close(outsnd);
+            sf_close(insnd);
+
+            const char *error = vio.error ? vio.error : wav.error;
+            if (error) {
+                priv2::fail(error);
+                return;
+            }
+
+            priv2::output::submit(output_filename, std::move(wav.data));
+        }, wav_size);
 
         i++;
     }
+
+    // Failures of the sounds are recorded for the unit
+    group.wait();
+    return true;
 }
 
+static priv2::handler::Format
+sound_format("fat", "Handled as FAT sound", priv2::handler::Format::DATA, "1.00"_cc, is_sound, decode_sound);
+
 };
 };
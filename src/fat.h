@@ -17,14 +17,16 @@
 
 #pragma once
 
+#include "path.h"
+
 namespace priv2 {
 namespace fat {
 
 bool
 is_sound(const char *buf, size_t len);
 
-void
-decode_sound(const char *buf, size_t len, const std::string &filename_prefix);
+bool
+decode_sound(const char *buf, size_t len, const priv2::path::Path &filename_prefix);
 
 };
 };
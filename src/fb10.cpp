@@ -26,8 +26,11 @@
 
 #include <vector>
 #include <string>
+#include <algorithm>
 
 #include "priv2.h"
+#include "log.h"
+#include "kernel.h"
 
 namespace priv2 {
 namespace fb10 {
@@ -46,15 +49,32 @@ is_compressed(const char *buf, size_t len)
     return (sig0 == 0x10 && sig1 == 0xfb);
 }
 
+uint32_t
+uncompressed_size(const char *buf, size_t len)
+{
+    if (!is_compressed(buf, len) || len < 5) {
+        return 0;
+    }
+
+    uint8_t *read_ptr = (uint8_t *)buf + 2;
+    return (read_ptr[0] << 16 | read_ptr[1] << 8 | read_ptr[2]);
+}
+
 std::vector<char>
 decompress(const char *buf, size_t len)
+{
+    std::vector<char> out;
+    decompress(buf, len, out);
+    return out;
+}
+
+bool
+decompress(const char *buf, size_t len, std::vector<char> &out)
 {
     if (!is_compressed(buf, len)) {
-        priv2::fail("Invalid compression detected");
+        return priv2::fail("Invalid compression detected");
     }
 
-    std::vector<char> out;
-
     uint8_t *read_ptr = (uint8_t *)buf;
     uint8_t *end_ptr = (uint8_t *)buf + len;
 
@@ -65,9 +85,13 @@ decompress(const char *buf, size_t len)
     uint8_t size1 = *read_ptr++;
     uint8_t size0 = *read_ptr++;
     uint32_t uncompressed_size = (size2 << 16 | size1 << 8 | size0);
-    printf("Uncompressed size: %d (compressed size: %d)\n",
+    priv2::log::debug("Uncompressed size: %d (compressed size: %d)\n",
             uncompressed_size, (int)len);
 
+    // Written through a pointer, grown only if the header was wrong
+    out.resize(uncompressed_size);
+    size_t pos = 0;
+
     while (read_ptr < end_ptr) {
         uint8_t byte0 = *read_ptr++;
 
@@ -98,29 +122,39 @@ decompress(const char *buf, size_t len)
             copy_offset = ((byte0 & 0x10) << 12) + (byte1 << 8) + byte2 + 1;
         } else if (byte0 >= 0xe0 && byte0 <= 0xfb) {
             int count = (byte0 - 0xdf) * 4;
-            for (int i=0; i<count; i++) {
-                out.push_back(*read_ptr++);
+            if (pos + count > out.size()) {
+                out.resize(std::max(pos + count, 2 * out.size()));
             }
+            memcpy(out.data() + pos, read_ptr, count);
+            read_ptr += count;
+            pos += count;
             continue;
         } else if (byte0 >= 0xfc && byte0 <= 0xff) {
             num_plain_text = byte0 & 0x03;
             num_to_copy = 0;
         } else {
-            printf("Unhandled control character: 0x%02x\n", byte0);
-            priv2::fail("TODO");
+            priv2::log::warning("Unhandled control character: 0x%02x\n", byte0);
+            return priv2::fail("TODO");
         }
 
-        for (int i=0; i<num_plain_text; i++) {
-            out.push_back(*read_ptr++);
+        if (pos + num_plain_text + num_to_copy > out.size()) {
+            out.resize(std::max(pos + num_plain_text + num_to_copy, 2 * out.size()));
         }
 
-        size_t cur_offset = out.size() - copy_offset;
-        for (int i=0; i<num_to_copy; i++) {
-            out.push_back(out[cur_offset++]);
+        memcpy(out.data() + pos, read_ptr, num_plain_text);
+        read_ptr += num_plain_text;
+        pos += num_plain_text;
+
+        if (num_to_copy > 0 && copy_offset > pos) {
+            return priv2::fail("Invalid back reference");
         }
+
+        priv2::kernel::copy_match(out.data() + pos, copy_offset, num_to_copy);
+        pos += num_to_copy;
     }
 
-    return out;
+    out.resize(pos);
+    return true;
 }
 
 };
@@ -19,14 +19,23 @@
 
 #include <vector>
 
+#include <cstdint>
+#include <cstddef>
+
 namespace priv2 {
 namespace fb10 {
 
 bool
 is_compressed(const char *buf, size_t len);
 
+uint32_t
+uncompressed_size(const char *buf, size_t len);
+
 std::vector<char>
 decompress(const char *buf, size_t len);
 
+bool
+decompress(const char *buf, size_t len, std::vector<char> &out);
+
 };
 };
@@ -0,0 +1,141 @@
+/*
+ * Privateer 2: The Darkening -- Data Dumper
+ * Copyright (c) 2016, 2017, Thomas Perl
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "filter.h"
+
+#include <fnmatch.h>
+
+#include <vector>
+
+#include "stats.h"
+
+namespace {
+
+typedef std::vector<std::string> Components;
+
+std::vector<Components>
+includes;
+
+std::vector<Components>
+excludes;
+
+priv2::stats::Counter
+nodes_skipped("Filter paths skipped");
+
+Components
+split(const std::string &path)
+{
+    Components result;
+
+    size_t pos = 0;
+    while (true) {
+        size_t end = path.find('/', pos);
+        result.emplace_back(path.substr(pos, end - pos));
+        if (end == std::string::npos) {
+            break;
+        }
+        pos = end + 1;
+    }
+
+    return result;
+}
+
+/**
+ * Check if the first <count> components of the pattern match those of the path.
+ **/
+bool
+matches(const Components &pattern, const Components &path, size_t count)
+{
+    for (size_t i=0; i<count; i++) {
+        if (fnmatch(pattern[i].c_str(), path[i].c_str(), 0) != 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+}; // end anonymous namespace
+
+namespace priv2 {
+namespace filter {
+
+void
+include(const std::string &pattern)
+{
+    includes.emplace_back(split(pattern));
+}
+
+void
+exclude(const std::string &pattern)
+{
+    excludes.emplace_back(split(pattern));
+}
+
+Result
+check(const std::string &path)
+{
+    if (includes.empty() && excludes.empty()) {
+        return INCLUDE;
+    }
+
+    auto components = split(path);
+
+    // A match of the path itself or of one of its parents
+    for (auto &pattern: excludes) {
+        if (pattern.size() <= components.size() && matches(pattern, components, pattern.size())) {
+            nodes_skipped.add(1);
+            return SKIP;
+        }
+    }
+
+    if (includes.empty()) {
+        return INCLUDE;
+    }
+
+    bool traverse = false;
+    for (auto &pattern: includes) {
+        if (pattern.size() <= components.size()) {
+            if (matches(pattern, components, pattern.size())) {
+                return INCLUDE;
+            }
+        } else if (matches(pattern, components, components.size())) {
+            // The pattern might match something below this path
+            traverse = true;
+        }
+    }
+
+    if (!traverse) {
+        nodes_skipped.add(1);
+        return SKIP;
+    }
+
+    return TRAVERSE;
+}
+
+Result
+check(const priv2::path::Path &path)
+{
+    if (includes.empty() && excludes.empty()) {
+        return INCLUDE;
+    }
+
+    return check(path.tree());
+}
+
+};
+};
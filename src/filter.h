@@ -0,0 +1,63 @@
+/*
+ * Privateer 2: The Darkening -- Data Dumper
+ * Copyright (c) 2016, 2017, Thomas Perl
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include <string>
+
+#include "path.h"
+
+namespace priv2 {
+namespace filter {
+
+/**
+ * Only extract the data whose logical path matches one of the include
+ * patterns (--include), and everything below it.
+ **/
+void include(const std::string &pattern);
+
+/**
+ * Skip the data whose logical path matches one of the exclude patterns
+ * (--exclude), and everything below it.
+ **/
+void exclude(const std::string &pattern);
+
+enum Result {
+    // Neither this nor anything below it is extracted
+    SKIP,
+    // Not extracted, but something below it might be
+    TRAVERSE,
+    // Extracted
+    INCLUDE,
+};
+
+/**
+ * Check what to do with the data at the given logical path, which is its
+ * name in the tree layout (e.g. SETS.IFF/ANHUR.IFF/ROOM/0008/BASE) in any
+ * layout. Patterns are matched with fnmatch() component by component, so
+ * that "*" does not match across a "/".
+ **/
+Result check(const std::string &path);
+
+/**
+ * Check the data at the given path, its name is only rendered if there
+ * are patterns to match against.
+ **/
+Result check(const priv2::path::Path &path);
+
+};
+};
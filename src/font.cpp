@@ -25,8 +25,10 @@
 #include <algorithm>
 
 #include "priv2.h"
+#include "log.h"
 #include "codepoint.h"
 #include "font.h"
+#include "handler.h"
 
 namespace {
 
@@ -53,14 +55,14 @@ is_font(const char *buf, size_t len)
 {
     uint32_t *read_ptr = (uint32_t *)buf;
 
-    return (len >= 4 && memcmp(priv2::fourcc(*read_ptr).c_str(), "1.\0\0", 4) == 0);
+    return (len >= 4 && priv2::FourCC(*read_ptr) == "1.\0\0"_cc);
 }
 
-void
-decode_font(const char *buf, size_t len, const std::string &filename_prefix)
+bool
+decode_font(const char *buf, size_t len, const priv2::path::Path &filename_prefix)
 {
     if (!is_font(buf, len)) {
-        priv2::fail("Invalid signature");
+        return priv2::fail("Invalid signature");
     }
 
     uint32_t *read_ptr = (uint32_t *)buf;
@@ -71,7 +73,7 @@ decode_font(const char *buf, size_t len, const std::string &filename_prefix)
     uint32_t num_chars = *read_ptr++;
     uint32_t height = *read_ptr++;
     uint32_t unknown = *read_ptr++;
-    printf("Num chars: %d, height: %d, unknown: 0x%08x\n",
+    priv2::log::verbose("Num chars: %d, height: %d, unknown: 0x%08x\n",
             num_chars, height, unknown);
 
     std::vector<FontChar> fontdef;
@@ -81,21 +83,23 @@ decode_font(const char *buf, size_t len, const std::string &filename_prefix)
         fontdef.emplace_back(i, offset, width);
     }
 
-    bool dump_to_console = false;
+    bool dump_to_console = priv2::log::enabled(priv2::log::DEBUG);
 
     uint32_t total_width = 1;
     const char *lut[] = {" ", "░", "▒", "▓", "█"};
     const size_t lutlen = sizeof(lut) / sizeof(lut[0]);
     for (auto &def: fontdef) {
         const char *codepoint_utf8 = priv2::codepoint::get_utf8(def.codepoint);
-        std::string repr =
-            codepoint_utf8 ? codepoint_utf8 :
-            priv2::format("%c", (def.codepoint > 31 && def.codepoint < 127) ? def.codepoint : '.');
+        std::string repr;
+        if (dump_to_console) {
+            repr = codepoint_utf8 ? codepoint_utf8 :
+                priv2::format("%c", (def.codepoint > 31 && def.codepoint < 127) ? def.codepoint : '.');
+        }
 
         if (def.width) {
             total_width += def.width + 1;
 
-            printf("Offset of char %3d / 0x%02x (%s): 0x%08x (width = %5d)\n",
+            priv2::log::debug("Offset of char %3d / 0x%02x (%s): 0x%08x (width = %5d)\n",
                     def.codepoint, def.codepoint, repr.c_str(), def.offset, def.width);
 
             if (dump_to_console) {
@@ -108,11 +112,11 @@ decode_font(const char *buf, size_t len, const std::string &filename_prefix)
                             value = 0xff;
                         }
                         uint32_t scaled = value * lutlen / 256;
-                        printf("%s", lut[scaled]);
+                        priv2::log::debug("%s", lut[scaled]);
                     }
-                    printf("\n");
+                    priv2::log::debug("\n");
                 }
-                printf("\n");
+                priv2::log::debug("\n");
             }
         }
     }
@@ -130,7 +134,7 @@ decode_font(const char *buf, size_t len, const std::string &filename_prefix)
         }
     }
 
-    printf("Font pixel intensity range: 0-%d\n", max_pixel);
+    priv2::log::verbose("Font pixel intensity range: 0-%d\n", max_pixel);
 
     std::string chardef;
     uint32_t xoffset = 0;
@@ -165,9 +169,13 @@ decode_font(const char *buf, size_t len, const std::string &filename_prefix)
         xoffset += def.width + 1;
     }
 
-    priv2::write_file(chardef, "%s-font.txt", filename_prefix.c_str());
-    priv2::write_png(tmp.data(), total_width, height, "%s-font.png", filename_prefix.c_str());
+    auto prefix = filename_prefix.str();
+    priv2::write_file(chardef, "%s-font.txt", prefix.c_str());
+    return priv2::write_png(tmp.data(), total_width, height, "%s-font.png", prefix.c_str());
 }
 
+static priv2::handler::Format
+font_format("font", "Handled as font", priv2::handler::Format::DATA, "1.\0\0"_cc, is_font, decode_font);
+
 };
 };
@@ -17,14 +17,16 @@
 
 #include <string>
 
+#include "path.h"
+
 namespace priv2 {
 namespace font {
 
 bool
 is_font(const char *buf, size_t len);
 
-void
-decode_font(const char *buf, size_t len, const std::string &filename_prefix);
+bool
+decode_font(const char *buf, size_t len, const priv2::path::Path &filename_prefix);
 
 };
 };
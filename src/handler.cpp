@@ -15,41 +15,121 @@
  * PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include "handler.h"
+
+#include <vector>
+#include <algorithm>
+
 #include "priv2.h"
 
-#include "big.h"
-#include "iff.h"
-#include "shp.h"
-#include "fat.h"
-#include "font.h"
-#include "base.h"
-#include "movielist.h"
+#include "cache.h"
+#include "filter.h"
+
+namespace {
+
+struct Registry {
+    // Sorted by magic number
+    std::vector<priv2::handler::Format *> magic;
+
+    // Sorted by priority
+    std::vector<priv2::handler::Format *> probed;
+};
+
+Registry &
+registry()
+{
+    // Function-local, as formats register during static initialization
+    static Registry result;
+    return result;
+}
+
+priv2::handler::Format *
+find_format(const char *buf, size_t len)
+{
+    auto &formats = registry();
+
+    if (len >= 4) {
+        priv2::FourCC magic(*(uint32_t *)buf);
+        auto it = std::lower_bound(formats.magic.begin(), formats.magic.end(), magic,
+                [] (const priv2::handler::Format *format, priv2::FourCC magic) {
+            return format->magic.value < magic.value;
+        });
+
+        for (; it != formats.magic.end() && (*it)->magic == magic; ++it) {
+            if ((*it)->probe == nullptr || (*it)->probe(buf, len)) {
+                return *it;
+            }
+        }
+    }
+
+    for (auto &format: formats.probed) {
+        if (format->probe(buf, len)) {
+            return format;
+        }
+    }
+
+    return nullptr;
+}
+
+}; // end anonymous namespace
 
 namespace priv2 {
 namespace handler {
 
-bool
-handle_data(const char *buf, size_t len, const std::string &filename_prefix)
+Format::Format(const char *name, const char *description, enum Kind kind, priv2::FourCC magic,
+        Probe probe, Decode decode)
+    : name(name)
+    , kind(kind)
+    , magic(magic)
+    , priority(0)
+    , probe(probe)
+    , decode(decode)
+    , hits(description)
+{
+    auto &formats = registry().magic;
+    formats.insert(std::upper_bound(formats.begin(), formats.end(), this,
+            [] (const Format *a, const Format *b) { return a->magic.value < b->magic.value; }), this);
+}
+
+Format::Format(const char *name, const char *description, int priority, Probe probe, Decode decode)
+    : name(name)
+    , kind(DATA)
+    , magic()
+    , priority(priority)
+    , probe(probe)
+    , decode(decode)
+    , hits(description)
 {
-    if (priv2::big::is_big(buf, len)) {
-        priv2::big::handle_big(buf, len, filename_prefix);
-    } else if (priv2::iff::is_iff(buf, len)) {
-        priv2::iff::handle_iff(buf, len, filename_prefix);
-    } else if (priv2::shp::is_image(buf, len)) {
-        priv2::shp::decode_image(buf, len, filename_prefix);
-    } else if (priv2::fat::is_sound(buf, len)) {
-        priv2::fat::decode_sound(buf, len, filename_prefix);
-    } else if (priv2::font::is_font(buf, len)) {
-        priv2::font::decode_font(buf, len, filename_prefix);
-    } else if (priv2::base::is_base(buf, len)) {
-        priv2::base::handle_base(buf, len, filename_prefix);
-    } else if (priv2::movielist::is_movielist(buf, len)) {
-        priv2::movielist::handle_movielist(buf, len, filename_prefix);
-    } else {
-        return false;
+    auto &formats = registry().probed;
+    formats.insert(std::upper_bound(formats.begin(), formats.end(), this,
+            [] (const Format *a, const Format *b) { return a->priority < b->priority; }), this);
+}
+
+Result
+handle_data(const char *buf, size_t len, const priv2::path::Path &filename_prefix)
+{
+    auto format = find_format(buf, len);
+
+    if (format != nullptr && format->kind == Format::CONTAINER) {
+        format->hits.add(1);
+        return format->decode(buf, len, filename_prefix) ? HANDLED : FAILED;
+    }
+
+    if (priv2::filter::check(filename_prefix) != priv2::filter::INCLUDE) {
+        // Not extracted, only containers are looked into for included data
+        return HANDLED;
     }
 
-    return true;
+    if (format == nullptr) {
+        return UNKNOWN;
+    }
+
+    format->hits.add(1);
+    bool ok = priv2::cache::run(format->name, buf, len, filename_prefix, [&] () {
+        return format->decode(buf, len, filename_prefix);
+    });
+
+    return ok ? HANDLED : FAILED;
 }
 
 };
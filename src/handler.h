@@ -19,12 +19,57 @@
 
 #include <string>
 
+#include "priv2.h"
+#include "path.h"
+#include "stats.h"
+
 
 namespace priv2 {
 namespace handler {
 
-bool
-handle_data(const char *buf, size_t len, const std::string &filename_prefix);
+/**
+ * A data format that handle_data() dispatches to. Formats are defined as
+ * static objects next to their decoder and register themselves on
+ * construction; data is matched by the magic number in its first four
+ * bytes, and only data without a known magic number is probed.
+ **/
+struct Format {
+    typedef bool (*Probe)(const char *buf, size_t len);
+    // Returns false if it failed (after priv2::fail())
+    typedef bool (*Decode)(const char *buf, size_t len, const priv2::path::Path &filename_prefix);
+
+    enum Kind {
+        DATA = 0, // decoded only if included, through the cache
+        CONTAINER = 1, // always looked into, for included data inside of it
+    };
+
+    // Format with a magic number, <probe> checks the rest of the header
+    Format(const char *name, const char *description, enum Kind kind, priv2::FourCC magic,
+            Probe probe, Decode decode);
+
+    // Format without magic number, probed in order of <priority> (lowest first)
+    Format(const char *name, const char *description, int priority, Probe probe, Decode decode);
+
+    // Also the kind of cache entries
+    const char *name;
+    enum Kind kind;
+    priv2::FourCC magic;
+    int priority;
+    Probe probe;
+    Decode decode;
+
+    // Number of times data was handled as this format (--stats)
+    priv2::stats::Counter hits;
+};
+
+enum Result {
+    UNKNOWN = 0, // no format matched, the caller may handle the data itself
+    HANDLED = 1,
+    FAILED = 2, // the decoder failed (after priv2::fail())
+};
+
+Result
+handle_data(const char *buf, size_t len, const priv2::path::Path &filename_prefix);
 
 };
 };
@@ -20,7 +20,9 @@
 
 #include "huffman.h"
 #include "priv2.h"
+#include "log.h"
 #include "codepoint.h"
+#include "writer.h"
 
 #include <cstdio>
 #include <cstdlib>
@@ -98,15 +100,14 @@ struct HuffmanTextChunkDecoder {
         , tree()
         , last_was_placeholder_marker(false)
     {
-        decode();
     }
 
+    bool decode();
     uint32_t count() const { return index.size() - 1; }
-    std::string get_entry(uint32_t i);
+    bool get_entry(uint32_t i, std::string &entry);
     std::string get_graphviz_source();
 
 private:
-    void decode();
     std::string get_node_name(uint16_t index);
 
     const char *buf;
@@ -147,14 +148,14 @@ HuffmanTextChunkDecoder::get_node_name(uint16_t index)
     return result;
 }
 
-void
+bool
 HuffmanTextChunkDecoder::decode()
 {
     uint32_t *read_ptr = (uint32_t *)buf;
     uint32_t start_tree = *read_ptr++;
     uint32_t num_entries = *read_ptr++;
 
-    printf("Tree start: %#010x (%d), num_entries: %#010x (%d)\n",
+    priv2::log::debug("Tree start: %#010x (%d), num_entries: %#010x (%d)\n",
             start_tree, start_tree, num_entries, num_entries);
 
     index.reserve(num_entries);
@@ -166,21 +167,21 @@ HuffmanTextChunkDecoder::decode()
     }
 
     if (read_ptr != (uint32_t *)(buf + start_tree)) {
-        printf("Warning: Start tree points to different offset\n");
+        priv2::log::warning("Start tree points to different offset\n");
     }
 
     uint32_t uncompressed_bytes = *read_ptr++;
-    printf("Estimated(?) uncompressed bytes in stream: %d\n", uncompressed_bytes);
+    priv2::log::debug("Estimated(?) uncompressed bytes in stream: %d\n", uncompressed_bytes);
 
     uint32_t tree_array_size = *read_ptr++;
-    printf("Tree array size: %d\n", tree_array_size);
+    priv2::log::debug("Tree array size: %d\n", tree_array_size);
 
     std::vector<uint32_t> nodes;
     uint32_t *node_end_ptr = (uint32_t *)(buf + index[0].byte_offset);
     while (read_ptr < node_end_ptr) {
         uint32_t value = *read_ptr++;
         if (value >= tree_array_size) {
-            printf("Warning: Ignoring invalid value 0x%08x (array size=%d)\n", value, tree_array_size);
+            priv2::log::warning("Ignoring invalid value 0x%08x (array size=%d)\n", value, tree_array_size);
             continue;
         }
         //printf("Tree[%d] = %#010x (%d) '%c'\n", nodes.size(), value, value, (value <= 31 || value >= 127) ? '.' : value);
@@ -211,17 +212,19 @@ HuffmanTextChunkDecoder::decode()
         }
 
         if (!found) {
-            priv2::fail("Could not insert node into tree");
+            return priv2::fail("Could not insert node into tree");
         }
     }
+
+    return true;
 }
 
 std::string
 HuffmanTextChunkDecoder::get_graphviz_source()
 {
-    std::string result;
+    priv2::writer::Writer result;
 
-    result += "digraph huffman {\n";
+    result.str("digraph huffman {\n");
     for (int i=0; i<tree.size(); i++) {
         if (tree[i].is_unused() || tree[i].is_leaf()) {
             continue;
@@ -232,17 +235,17 @@ HuffmanTextChunkDecoder::get_graphviz_source()
         for (int k=0; k<2; k++) {
             int j = tree[i].get_index(k);
             if (j != HuffTreeNode::EMPTY) {
-                result += priv2::format("\"%s\" -> \"%s\" [ label = \"%d\" ];\n", get_node_name(i).c_str(), get_node_name(j).c_str(), k);
+                result.chr('"').str(name).str("\" -> \"").str(get_node_name(j)).str("\" [ label = \"").dec(k).str("\" ];\n");
             }
         }
     }
-    result += "}\n";
+    result.str("}\n");
 
-    return result;
+    return result.string();
 }
 
-std::string
-HuffmanTextChunkDecoder::get_entry(uint32_t i)
+bool
+HuffmanTextChunkDecoder::get_entry(uint32_t i, std::string &entry)
 {
     std::vector<char> result;
     uint32_t j = root_node;
@@ -254,7 +257,7 @@ HuffmanTextChunkDecoder::get_entry(uint32_t i)
         auto &n = tree[j];
 
         if (n.is_unused()) {
-            priv2::fail("Invalid tree");
+            return priv2::fail("Invalid tree");
         }
 
         if (n.is_leaf()) {
@@ -288,7 +291,8 @@ HuffmanTextChunkDecoder::get_entry(uint32_t i)
         }
     }
 
-    return std::string(result.data(), result.size());
+    entry.assign(result.data(), result.size());
+    return true;
 }
 
 };
@@ -296,16 +300,22 @@ HuffmanTextChunkDecoder::get_entry(uint32_t i)
 namespace priv2 {
 namespace huffman {
 
-DecodeResult
-decode(const char *buf, size_t len)
+bool
+decode(const char *buf, size_t len, DecodeResult &result)
 {
-    DecodeResult result;
     HuffmanTextChunkDecoder dec(buf, len);
+    if (!dec.decode()) {
+        return false;
+    }
+
     for (int i=0; i<dec.count(); i++) {
-        result.items.emplace_back(dec.get_entry(i));
+        result.items.emplace_back();
+        if (!dec.get_entry(i, result.items.back())) {
+            return false;
+        }
     }
     result.graphviz_dot_src = dec.get_graphviz_source();
-    return result;
+    return true;
 }
 
 };
@@ -30,7 +30,7 @@ struct DecodeResult {
     std::string graphviz_dot_src;
 };
 
-DecodeResult decode(const char *buf, size_t len);
+bool decode(const char *buf, size_t len, DecodeResult &result);
 
 };
 };
@@ -22,8 +22,11 @@
 #include <math.h>
 
 #include <string>
+#include <map>
+#include <algorithm>
 
 #include "priv2.h"
+#include "log.h"
 #include "huffman.h"
 #include "fb10.h"
 #include "deflate.h"
@@ -35,27 +38,158 @@
 #include "handler.h"
 #include "palette.h"
 #include "textdetect.h"
+#include "task.h"
+#include "shard.h"
+#include "journal.h"
+#include "filter.h"
+#include "writer.h"
+#include "unit.h"
+#include "pool.h"
 
 namespace {
 
+using priv2::operator"" _cc;
+
+/**
+ * Contents of a chunk of a form: chunks stored as-is point into the input
+ * buffer, only decompressed chunks own their data (in <decompressed>).
+ **/
 struct FormChunk {
-    FormChunk(const std::string &sig, std::vector<char> &&content)
-        : sig(sig)
-        , content()
-    {
-        std::swap(this->content, content);
+    FormChunk(priv2::FourCC sig) : sig(sig), buf(nullptr), len(0), decompressed(), failed(false) {}
+
+    void set(const char *buf, size_t len) {
+        this->buf = buf;
+        this->len = len;
+    }
+
+    void set(std::vector<char> &&content) {
+        std::swap(decompressed, content);
+        set(decompressed.data(), decompressed.size());
     }
 
-    std::string sig;
-    std::vector<char> content;
+    priv2::FourCC sig;
+    const char *buf;
+    size_t len;
+    std::vector<char> decompressed;
+    // Set if the unit of the chunk failed (buf is nullptr then)
+    bool failed;
+};
+
+/**
+ * Chunks that handle_complete_form() uses, by form type; all other chunks
+ * are dropped as soon as they have been handled.
+ **/
+const struct {
+    priv2::FourCC form;
+    priv2::FourCC chunks[10];
+} RETAINED_CHUNKS[] = {
+    { "BR3D"_cc, { "FORM"_cc, "3DNM"_cc, "3VTS"_cc, "MATS"_cc, "3FCS"_cc, "3FLG"_cc, "VERS"_cc, "FMTS"_cc, "FACS"_cc } },
+    { "BRPM"_cc, { "PMIF"_cc, "PMDT"_cc } },
+};
+
+bool
+is_complete_form(priv2::FourCC form_sig)
+{
+    for (auto &retained: RETAINED_CHUNKS) {
+        if (form_sig == retained.form) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool
+is_retained(priv2::FourCC form_sig, priv2::FourCC chunk_sig)
+{
+    for (auto &retained: RETAINED_CHUNKS) {
+        if (form_sig == retained.form) {
+            for (auto chunk: retained.chunks) {
+                if (chunk_sig == chunk) {
+                    return true;
+                }
+            }
+        }
+    }
+
+    return false;
+}
+
+struct ChunkRef {
+    ChunkRef(priv2::FourCC sig, char *buf, uint32_t len) : sig(sig), name(), buf(buf), len(len), retained(-1) {}
+
+    priv2::FourCC sig;
+    // Name in the tree layout (unique within the form)
+    std::string name;
+    char *buf;
+    uint32_t len;
+    // Index in Form::chunks, or -1 if the chunk is not retained
+    int retained;
+};
+
+// Signature and index in Form::chunks, sorted by signature, then index
+typedef std::vector<std::pair<uint32_t, uint32_t>> ChunkIndex;
+
+/**
+ * Chunks of a form with the same signature, in the order of the file.
+ **/
+struct ChunkRange {
+    struct iterator {
+        iterator(std::vector<FormChunk> &chunks, ChunkIndex::const_iterator pos) : chunks(chunks), pos(pos) {}
+
+        FormChunk &operator*() const { return chunks[pos->second]; }
+        iterator &operator++() { ++pos; return *this; }
+        bool operator!=(const iterator &other) const { return pos != other.pos; }
+
+        std::vector<FormChunk> &chunks;
+        ChunkIndex::const_iterator pos;
+    };
+
+    iterator begin() const { return iterator(chunks, first); }
+    iterator end() const { return iterator(chunks, last); }
+    bool empty() const { return first == last; }
+
+    std::vector<FormChunk> &chunks;
+    ChunkIndex::const_iterator first;
+    ChunkIndex::const_iterator last;
 };
 
 struct Form {
-    Form(const std::string &sig) : sig(sig) {}
+    Form(priv2::FourCC sig, const priv2::path::Path &path) : sig(sig), path(path), chunks(), index() {}
+
+    // Add a chunk (its contents are set later), returns its index in chunks
+    uint32_t add_chunk(priv2::FourCC signature) {
+        auto entry = std::make_pair(signature.value, (uint32_t)chunks.size());
+        index.insert(std::upper_bound(index.begin(), index.end(), entry), entry);
+        chunks.emplace_back(signature);
+        return entry.second;
+    }
 
-    FormChunk *get_chunk(const std::string &signature) {
+    ChunkRange get_chunks(priv2::FourCC signature) {
+        return ChunkRange{chunks,
+            std::lower_bound(index.begin(), index.end(), std::make_pair(signature.value, 0u)),
+            std::upper_bound(index.begin(), index.end(), std::make_pair(signature.value, 0xFFFFFFFFu))};
+    }
+
+    // Fails (and returns nullptr) if there is no such chunk
+    FormChunk *get_chunk(priv2::FourCC signature) {
+        auto range = get_chunks(signature);
+        if (range.empty() || (*range.begin()).buf == nullptr) {
+            priv2::fail(priv2::format("Could not get chunk: %s", signature.str().c_str()));
+            return nullptr;
+        }
+
+        return &*range.begin();
+    }
+
+    bool has_chunk(priv2::FourCC signature) {
+        return !get_chunks(signature).empty();
+    }
+
+    // Retained chunk that failed or was not handled, or nullptr
+    FormChunk *missing_chunk() {
         for (auto &chunk: chunks) {
-            if (chunk.sig == signature) {
+            if (chunk.buf == nullptr) {
                 return &chunk;
             }
         }
@@ -63,77 +197,162 @@ struct Form {
         return nullptr;
     }
 
-    bool has_chunk(const std::string &signature) {
-        return get_chunk(signature) != nullptr;
-    }
+    priv2::FourCC sig;
+    priv2::path::Path path;
+    std::vector<FormChunk> chunks;
+    ChunkIndex index;
+};
 
-    template <typename T>
-    T *get_chunk_as(const std::string &signature) {
-        auto chunk = get_chunk(signature);
-        if (chunk == nullptr) {
-            priv2::fail("Could not get chunk");
+/**
+ * Read the chunk headers of a FORM payload (the form type, followed by the
+ * chunks) that is at <offset> in the file, and append them to <result>.
+ * Returns false if the headers are broken.
+ **/
+bool
+read_chunks(const char *form_buf, size_t form_len, uint32_t offset, uint32_t parent,
+        std::vector<priv2::iff::Node> &result)
+{
+    const char *form_end = form_buf + form_len;
+
+    // skip form type
+    uint32_t *read_ptr = (uint32_t *)form_buf + 1;
+
+    while ((char *)read_ptr < form_end) {
+        if (form_end - (char *)read_ptr < 8) {
+            return priv2::fail("Truncated chunk header");
+        }
+
+        priv2::iff::Node node;
+        node.sig = priv2::FourCC(*read_ptr++);
+        node.length = priv2::byteswap(*read_ptr++);
+        char *local_buf = (char *)read_ptr;
+
+        if (node.length == 0) {
+            return priv2::fail("Zero length chunk, there's probably something wrong with parsing");
+        }
+
+        if (node.length > (size_t)(form_end - local_buf)) {
+            return priv2::fail(priv2::format("Chunk length exceeds its form: sig='%s', length=%u",
+                        node.sig.str().c_str(), node.length));
+        }
+
+        node.offset = offset + (local_buf - form_buf);
+        if (priv2::fb10::is_compressed(local_buf, node.length)) {
+            node.compression = priv2::iff::FB10;
+        } else if (priv2::deflate::is_compressed(local_buf, node.length)) {
+            node.compression = priv2::iff::DEFLATE;
+        } else {
+            node.compression = priv2::iff::UNCOMPRESSED;
         }
 
-        return (T *)chunk->content.data();
+        bool is_form = (node.sig == "FORM"_cc && node.length >= 4 &&
+                node.compression == priv2::iff::UNCOMPRESSED);
+        node.type = priv2::FourCC(is_form ? *(uint32_t *)local_buf : 0);
+
+        node.parent = parent;
+        node.first_child = 0;
+        node.child_count = 0;
+        result.push_back(node);
+
+        read_ptr = (uint32_t *)(local_buf + node.length + (node.length % 2));
     }
 
-    std::string sig;
-    std::vector<FormChunk> chunks;
-};
+    return true;
+}
+
+/**
+ * Names of the <count> chunks from <first> in the tree layout: chunks are
+ * named by signature (nested forms by their form type), with the offset
+ * added where that is not unique within the form.
+ **/
+std::vector<std::string>
+chunk_names(const std::vector<priv2::iff::Node> &nodes, uint32_t first, uint32_t count)
+{
+    std::vector<std::string> names;
+    std::map<std::string, int> name_count;
+    for (uint32_t i=first; i<first+count; i++) {
+        names.emplace_back((nodes[i].type != priv2::FourCC() ? nodes[i].type : nodes[i].sig).str());
+        name_count[names.back()]++;
+    }
+
+    for (uint32_t i=0; i<count; i++) {
+        if (name_count[names[i]] > 1) {
+            names[i] += priv2::format("-%#010x", nodes[first + i].offset);
+        }
+    }
+
+    return names;
+}
 
 class IFF {
 public:
-    IFF(const char *buf, size_t len, const std::string &filename_prefix)
+    IFF(const char *buf, size_t len, const priv2::path::Path &filename_prefix)
         : buf(buf)
         , len(len)
         , filename_prefix(filename_prefix)
+        , key(filename_prefix.flat())
     {}
 
     bool is_iff();
 
-    void parse();
+    bool parse();
 
-    void handle_form(const std::string &path_sig, const std::string &sig,
-            uint32_t offset, const char *form_buf, size_t form_len);
+    // <root>: the children of the form are work units of --shard
+    bool handle_form(const priv2::path::Path &form_path, const std::string &path_sig, priv2::FourCC sig,
+            uint32_t offset, const char *form_buf, size_t form_len, bool root=false);
 
-    void handle_chunk(const std::string &path_sig, const std::string &form_sig, const std::string &sig,
-            size_t offset, char *buf, uint32_t len);
+    bool handle_chunk(const priv2::path::Path &basename, const std::string &path_sig, priv2::FourCC form_sig,
+            priv2::FourCC sig, priv2::filter::Result mode, size_t offset, char *buf, uint32_t len);
 
-    void handle_complete_form(Form &form);
+    bool handle_complete_form(Form &form);
 
 private:
     const char *buf;
     size_t len;
-    std::string filename_prefix;
+    priv2::path::Path filename_prefix;
+    // Name of the file for the shard and journal
+    std::string key;
 };
 
-void
-IFF::handle_chunk(const std::string &path_sig, const std::string &form_sig, const std::string &sig,
-        size_t offset, char *buf, uint32_t len)
+bool
+IFF::handle_chunk(const priv2::path::Path &basename, const std::string &path_sig, priv2::FourCC form_sig,
+        priv2::FourCC sig, priv2::filter::Result mode, size_t offset, char *buf, uint32_t len)
 {
-    auto basename = priv2::format("%s-chunk-%#010x-%s%s%s-%s", filename_prefix.c_str(), (uint32_t)offset,
-            path_sig.c_str(), (path_sig.empty() ? "" : "-"), form_sig.c_str(), sig.c_str());
+    if (mode != priv2::filter::INCLUDE) {
+        // Not extracted, only look for included data inside of it
+        if (mode == priv2::filter::TRAVERSE) {
+            if (sig == "FORM"_cc) {
+                return handle_form(basename, path_sig + (path_sig.empty() ? "" : "-") + form_sig.str(),
+                        sig, offset, buf, len);
+            } else {
+                return priv2::handler::handle_data(buf, len, basename) != priv2::handler::FAILED;
+            }
+        }
 
-    if (sig != "FORM") {
+        return true;
+    }
+
+    if (sig != "FORM"_cc) {
         // Do not write out FORM chunks, as we handle them below
         //priv2::write_file(buf, len, "%s.bin", basename.c_str());
     }
 
-    if (sig == "BMTD") {
-        printf("That would be XMI MIDI\n");
-        priv2::write_file(buf, len, "%s-midi.xmi", basename.c_str());
-    } else if (priv2::handler::handle_data(buf, len, basename)) {
-        // Handled
-    } else if (sig == "FORM") {
-        handle_form(path_sig + (path_sig.empty() ? "" : "-") + form_sig,
+    priv2::handler::Result result = priv2::handler::UNKNOWN;
+    if (sig == "BMTD"_cc) {
+        priv2::log::verbose("That would be XMI MIDI\n");
+        priv2::write_file(buf, len, "%s-midi.xmi", basename.str().c_str());
+    } else if ((result = priv2::handler::handle_data(buf, len, basename)) != priv2::handler::UNKNOWN) {
+        return result != priv2::handler::FAILED;
+    } else if (sig == "FORM"_cc) {
+        return handle_form(basename, path_sig + (path_sig.empty() ? "" : "-") + form_sig.str(),
                 sig, offset, buf, len);
     } else {
         std::vector<std::string> decoded_text;
 
-        auto text_encoding = priv2::textdetect::get_text_encoding(basename);
+        auto text_encoding = priv2::textdetect::get_text_encoding(basename.flat());
         switch (text_encoding) {
             case priv2::textdetect::NONE:
-                printf("Unhandled chunk of %d bytes\n", len);
+                priv2::log::verbose("Unhandled chunk of %d bytes\n", len);
                 break;
             case priv2::textdetect::STRINGLIST:
                 {
@@ -152,22 +371,29 @@ IFF::handle_chunk(const std::string &path_sig, const std::string &form_sig, cons
                 break;
             case priv2::textdetect::HUFFMAN:
                 {
-                    auto huffman_result = priv2::huffman::decode(buf, len);
+                    priv2::huffman::DecodeResult huffman_result;
+                    if (!priv2::huffman::decode(buf, len, huffman_result)) {
+                        return false;
+                    }
                     decoded_text = huffman_result.items;
-                    priv2::write_file(huffman_result.graphviz_dot_src, "%s-huffman.dot", basename.c_str());
+                    priv2::write_file(huffman_result.graphviz_dot_src, "%s-huffman.dot", basename.str().c_str());
                 }
                 break;
             case priv2::textdetect::INDEXED:
-                decoded_text = priv2::text::decode(buf, len);
+                if (!priv2::text::decode(buf, len, decoded_text)) {
+                    return false;
+                }
                 break;
             default:
-                priv2::fail("Unhandled text encoding");
+                return priv2::fail("Unhandled text encoding");
         }
 
         if (decoded_text.size()) {
-            priv2::write_file(decoded_text, "%s-lines.txt", basename.c_str());
+            priv2::write_file(decoded_text, "%s-lines.txt", basename.str().c_str());
         }
     }
+
+    return true;
 }
 
 struct Face {
@@ -186,127 +412,150 @@ struct BRMaterial {
     std::vector<Face> faces;
 };
 
-void
+bool
 IFF::handle_complete_form(Form &form)
 {
-    if (form.sig == "BR3D") {
-        printf("Handling BRender 3D Model\n");
+    if (form.sig == "BR3D"_cc) {
+        priv2::log::info("Handling BRender 3D Model\n");
 
         std::vector<BRMaterial> materials;
-        for (auto &child: form.chunks) {
-            if (child.sig == "FORM") {
-                uint8_t *end_ptr = (uint8_t *)(child.content.data() + child.content.size());
-                uint32_t *read_ptr = (uint32_t *)child.content.data();
-                auto form_name = priv2::fourcc(*read_ptr++);
-                if (form_name == "BMAT") {
-                    std::string name;
-                    std::string colormap;
-                    while ((uint8_t *)read_ptr < end_ptr) {
-                        auto element_name = priv2::fourcc(*read_ptr++);
-                        uint32_t length = priv2::byteswap(*read_ptr++);
-                        if (element_name == "MNAM" || element_name == "MCMP") {
-                            printf("BMAT Element: %s (length=%d) -> '%s'\n", element_name.c_str(), length,
+        for (auto &child: form.get_chunks("FORM"_cc)) {
+            uint8_t *end_ptr = (uint8_t *)(child.buf + child.len);
+            uint32_t *read_ptr = (uint32_t *)child.buf;
+            priv2::FourCC form_name(*read_ptr++);
+            if (form_name == "BMAT"_cc) {
+                std::string name;
+                std::string colormap;
+                while ((uint8_t *)read_ptr < end_ptr) {
+                    priv2::FourCC element_name(*read_ptr++);
+                    uint32_t length = priv2::byteswap(*read_ptr++);
+                    if (element_name == "MNAM"_cc || element_name == "MCMP"_cc) {
+                        if (priv2::log::enabled(priv2::log::DEBUG)) {
+                            priv2::log::debug("BMAT Element: %s (length=%d) -> '%s'\n", element_name.str().c_str(), length,
                                     (char *)read_ptr);
-                            if (element_name == "MNAM") {
-                                name = (char *)read_ptr;
-                            } else if (element_name == "MCMP") {
-                                colormap = (char *)read_ptr;
-                            }
                         }
-                        read_ptr = (uint32_t *)(((uint8_t *)read_ptr) + length + (length % 2));
+                        if (element_name == "MNAM"_cc) {
+                            name = (char *)read_ptr;
+                        } else if (element_name == "MCMP"_cc) {
+                            colormap = (char *)read_ptr;
+                        }
                     }
-                    materials.emplace_back(name, colormap);
+                    read_ptr = (uint32_t *)(((uint8_t *)read_ptr) + length + (length % 2));
                 }
+                materials.emplace_back(name, colormap);
             }
         }
 
-        std::string mtlsrc;
+        priv2::writer::Writer mtl;
         for (auto &material: materials) {
-            printf("Material: '%s' -> '%s'\n", material.name.c_str(), material.colormap.c_str());
+            priv2::log::verbose("Material: '%s' -> '%s'\n", material.name.c_str(), material.colormap.c_str());
 
-            std::string cmap = "SPACETEX.IFF-";
+            std::string pixmap;
             for (auto c: material.colormap) {
                 if (c == '.') {
                     // remove ".pix" extension
                     break;
                 }
-                cmap += tolower(c);
+                pixmap += tolower(c);
             }
-            cmap += ".iff-brpm.png";
-
-            mtlsrc += priv2::format("newmtl %s\n", material.name.c_str());
-            mtlsrc += "Ka 1.000 1.000 1.000\n";
-            mtlsrc += "Kd 1.000 1.000 1.000\n";
-            mtlsrc += "Ks 0.000 0.000 0.000\n";
-            mtlsrc += "d 1.0\n";
-            mtlsrc += "illum 2\n";
-            mtlsrc += priv2::format("map_Ka %s\n", cmap.c_str());
-            mtlsrc += priv2::format("map_Kd %s\n", cmap.c_str());
-            mtlsrc += "\n";
-        }
-
-        auto mtl_filename = priv2::format("%s-mesh.mtl", filename_prefix.c_str());
-        priv2::write_file(mtlsrc, "%s", mtl_filename.c_str());
-
-        std::string name = form.get_chunk_as<const char>("3DNM");
-        uint16_t n_vertices = *(form.get_chunk_as<uint16_t>("3VTS"));
-        uint16_t n_materials = *(form.get_chunk_as<uint16_t>("MATS"));
-        uint16_t n_faces = *(form.get_chunk_as<uint16_t>("3FCS"));
-        uint16_t flags = *(form.get_chunk_as<uint16_t>("3FLG"));
-        printf("Model name: '%s', vertices: %d, faces: %d, materials: %d, flags: 0x%04x\n",
-                name.c_str(), n_vertices, n_faces, n_materials, flags);
 
-        std::string objsrc = priv2::format("usemtl %s\n", mtl_filename.c_str());
+            std::string cmap;
+            if (priv2::path::get_layout() == priv2::path::TREE) {
+                // Relative to the directory of the .mtl file
+                for (auto c: form.path.tree()) {
+                    if (c == '/') {
+                        cmap += "../";
+                    }
+                }
+                cmap += "SPACETEX.IFF/" + pixmap + ".iff/BRPM-brpm.png";
+            } else {
+                cmap = "SPACETEX.IFF-" + pixmap + ".iff-brpm.png";
+            }
 
-        auto vertices = form.get_chunk("VERS");
-        printf("Vertices size: %d (%d bytes / vertex), %d floats / vertex\n",
-                (int)vertices->content.size(), (int)vertices->content.size() / n_vertices,
-                (int)(vertices->content.size() / n_vertices / sizeof(float)));
+            mtl.str("newmtl ").str(material.name).chr('\n');
+            mtl.str("Ka 1.000 1.000 1.000\n");
+            mtl.str("Kd 1.000 1.000 1.000\n");
+            mtl.str("Ks 0.000 0.000 0.000\n");
+            mtl.str("d 1.0\n");
+            mtl.str("illum 2\n");
+            mtl.str("map_Ka ").str(cmap).chr('\n');
+            mtl.str("map_Kd ").str(cmap).chr('\n');
+            mtl.chr('\n');
+        }
 
-        if (vertices->content.size() != n_vertices * 10 * sizeof(float)) {
-            priv2::fail("Invalid vertices data size");
+        auto mtl_filename = priv2::format("%s-mesh.mtl", form.path.str().c_str());
+        mtl.write_file("%s", mtl_filename.c_str());
+
+        auto name_chunk = form.get_chunk("3DNM"_cc);
+        auto n_vertices_chunk = form.get_chunk("3VTS"_cc);
+        auto n_materials_chunk = form.get_chunk("MATS"_cc);
+        auto n_faces_chunk = form.get_chunk("3FCS"_cc);
+        auto flags_chunk = form.get_chunk("3FLG"_cc);
+        auto vertices = form.get_chunk("VERS"_cc);
+        auto face_materials = form.get_chunk("FMTS"_cc);
+        auto faces = form.get_chunk("FACS"_cc);
+        if (!name_chunk || !n_vertices_chunk || !n_materials_chunk || !n_faces_chunk || !flags_chunk ||
+                !vertices || !face_materials || !faces) {
+            return false;
         }
 
-        auto face_materials = form.get_chunk("FMTS");
-        if (face_materials->content.size() != n_faces * 32) {
-            priv2::fail("Invalid face material size");
+        std::string name = name_chunk->buf;
+        uint16_t n_vertices = *(uint16_t *)n_vertices_chunk->buf;
+        uint16_t n_materials = *(uint16_t *)n_materials_chunk->buf;
+        uint16_t n_faces = *(uint16_t *)n_faces_chunk->buf;
+        uint16_t flags = *(uint16_t *)flags_chunk->buf;
+        priv2::log::verbose("Model name: '%s', vertices: %d, faces: %d, materials: %d, flags: 0x%04x\n",
+                name.c_str(), n_vertices, n_faces, n_materials, flags);
+
+        priv2::writer::Writer obj;
+        obj.str("usemtl ").str(priv2::basename(mtl_filename)).chr('\n');
+
+        priv2::log::debug("Vertices size: %d (%d bytes / vertex), %d floats / vertex\n",
+                (int)vertices->len, (int)vertices->len / n_vertices,
+                (int)(vertices->len / n_vertices / sizeof(float)));
+
+        if (vertices->len != n_vertices * 10 * sizeof(float)) {
+            return priv2::fail("Invalid vertices data size");
         }
 
-        for (int i=0; i<n_faces; i++) {
-            char *matname = face_materials->content.data() + i * 32;
-            printf("Face material: '%s'\n", matname);
+        if (face_materials->len != n_faces * 32) {
+            return priv2::fail("Invalid face material size");
         }
 
-        std::string vtxsrc;
+        for (int i=0; i<n_faces && priv2::log::enabled(priv2::log::DEBUG); i++) {
+            const char *matname = face_materials->buf + i * 32;
+            priv2::log::debug("Face material: '%s'\n", matname);
+        }
 
-        float *vertexdata = form.get_chunk_as<float>("VERS");
+        float *vertexdata = (float *)vertices->buf;
         for (int i=0; i<n_vertices; i++) {
-            vtxsrc += priv2::format("v %.10f %.10f %.10f\n", vertexdata[0], vertexdata[1], vertexdata[2]);
-            vtxsrc += priv2::format("vt %.10f %.10f\n", vertexdata[3], 1.f-vertexdata[4]);
+            obj.str("v ").fixed(vertexdata[0], 10).chr(' ').fixed(vertexdata[1], 10).chr(' ').fixed(vertexdata[2], 10).chr('\n');
+            obj.str("vt ").fixed(vertexdata[3], 10).chr(' ').fixed(1.f-vertexdata[4], 10).chr('\n');
             //vtxsrc += priv2::format("vn %f %f %f\n", -vertexdata[7], -vertexdata[8], -vertexdata[9]);
-            printf("Vtx[%d]: ", i);
-            for (int j=0; j<10; j++) {
-                printf(" %6.2f ", vertexdata[j]);
+            if (priv2::log::enabled(priv2::log::DEBUG)) {
+                priv2::log::debug("Vtx[%d]: ", i);
+                for (int j=0; j<10; j++) {
+                    priv2::log::debug(" %6.2f ", vertexdata[j]);
+                }
+                float length = sqrtf(
+                        vertexdata[7] * vertexdata[7] +
+                        vertexdata[8] * vertexdata[8] +
+                        vertexdata[9] * vertexdata[9]
+                );
+                priv2::log::debug(" normal length=%.2f\n", length);
             }
-            float length = sqrtf(
-                    vertexdata[7] * vertexdata[7] +
-                    vertexdata[8] * vertexdata[8] +
-                    vertexdata[9] * vertexdata[9]
-            );
-            printf(" normal length=%.2f\n", length);
             vertexdata += 10;
         }
 
-        auto faces = form.get_chunk("FACS");
-        printf("Faces size: %d (%d bytes / face)\n",
-                (int)faces->content.size(), (int)faces->content.size() / n_faces);
-        if (faces->content.size() != n_faces * 18 * sizeof(uint16_t)) {
-            priv2::fail("Invalid faces data size");
+        priv2::log::debug("Faces size: %d (%d bytes / face)\n",
+                (int)faces->len, (int)faces->len / n_faces);
+        if (faces->len != n_faces * 18 * sizeof(uint16_t)) {
+            return priv2::fail("Invalid faces data size");
         }
 
-        uint16_t *facedata = form.get_chunk_as<uint16_t>("FACS");
+        uint16_t *facedata = (uint16_t *)faces->buf;
         for (int i=0; i<n_faces; i++) {
-            std::string matname = face_materials->content.data() + i * 32;
+            std::string matname = face_materials->buf + i * 32;
 
             BRMaterial *mat = nullptr;
             for (auto &m: materials) {
@@ -317,152 +566,254 @@ IFF::handle_complete_form(Form &form)
             }
 
             if (mat == nullptr) {
-                priv2::fail(priv2::format("Could not find material: %s", matname.c_str()));
+                return priv2::fail(priv2::format("Could not find material: %s", matname.c_str()));
             }
 
             mat->faces.emplace_back(facedata[0]+1, facedata[1]+1, facedata[2]+1);
-            printf("Face[%d]: ", i);
-            for (int j=0; j<18; j++ ){
-                printf(" %5d", facedata[j]);
+            if (priv2::log::enabled(priv2::log::DEBUG)) {
+                priv2::log::debug("Face[%d]: ", i);
+                for (int j=0; j<18; j++ ){
+                    priv2::log::debug(" %5d", facedata[j]);
+                }
+                priv2::log::debug("\n");
             }
-            printf("\n");
             facedata += 18;
         }
 
-        objsrc += vtxsrc;
         for (auto &mat: materials) {
-            objsrc += priv2::format("o %s-%s\n", name.c_str(), mat.name.c_str());
-            objsrc += priv2::format("usemtl %s\n", mat.name.c_str());
+            obj.str("o ").str(name).chr('-').str(mat.name).chr('\n');
+            obj.str("usemtl ").str(mat.name).chr('\n');
             for (auto &face: mat.faces) {
-                objsrc += priv2::format("f %d/%d %d/%d %d/%d\n",
-                        face.a, face.a,
-                        face.b, face.b,
-                        face.c, face.c);
+                obj.str("f ").dec(face.a).chr('/').dec(face.a);
+                obj.chr(' ').dec(face.b).chr('/').dec(face.b);
+                obj.chr(' ').dec(face.c).chr('/').dec(face.c).chr('\n');
             }
         }
 
-        priv2::write_file(objsrc, "%s-mesh.obj", filename_prefix.c_str());
+        obj.write_file("%s-mesh.obj", form.path.str().c_str());
     }
 
-    if (form.sig == "BRPM" && form.has_chunk("PMIF") && form.has_chunk("PMDT")) {
-        printf("Handling BRender Pixmap\n");
+    if (form.sig == "BRPM"_cc && form.has_chunk("PMIF"_cc) && form.has_chunk("PMDT"_cc)) {
+        priv2::log::info("Handling BRender Pixmap\n");
 
-        auto pmif = form.get_chunk("PMIF");
-        auto pmdt = form.get_chunk("PMDT");
+        auto pmif = form.get_chunk("PMIF"_cc);
+        auto pmdt = form.get_chunk("PMDT"_cc);
+        if (!pmif || !pmdt) {
+            return false;
+        }
 
-        if (pmif->content.size() != 14) {
-            priv2::fail("Invalid PMIF chunk size");
+        if (pmif->len != 14) {
+            return priv2::fail("Invalid PMIF chunk size");
         }
 
-        uint16_t *read_ptr = (uint16_t *)pmif->content.data();
+        uint16_t *read_ptr = (uint16_t *)pmif->buf;
         uint16_t width = *read_ptr++;
         uint16_t unknown0 = *read_ptr++;
         if (unknown0 != 0x203) {
-            priv2::fail(priv2::format("Unexpected unknown0 value: 0x%04x", unknown0));
+            return priv2::fail(priv2::format("Unexpected unknown0 value: 0x%04x", unknown0));
         }
         uint16_t unknown1 = *read_ptr++;
         if (unknown1 != 0) {
-            priv2::fail(priv2::format("Unexpected unknown1 value: 0x%04x", unknown1));
+            return priv2::fail(priv2::format("Unexpected unknown1 value: 0x%04x", unknown1));
         }
         uint16_t unknown2 = *read_ptr++;
         if (unknown2 != width) {
-            priv2::fail(priv2::format("Unexpected unknown2 value: 0x%04x", unknown2));
+            return priv2::fail(priv2::format("Unexpected unknown2 value: 0x%04x", unknown2));
         }
         uint16_t height = *read_ptr++;
         uint16_t unknown3 = *read_ptr++;
         uint16_t unknown4 = *read_ptr++;
 
-        auto filename = priv2::format("%s-brpm.png", filename_prefix.c_str());
+        auto filename = priv2::format("%s-brpm.png", form.path.str().c_str());
 
-        printf("Got PMIF: dt.size=%d, width=%d, height=%d, unks=[%d, %d, %d, %d, %d] -> %s\n",
-                (int)pmdt->content.size(), width, height, unknown0, unknown1, unknown2,
+        priv2::log::info("Got PMIF: dt.size=%d, width=%d, height=%d, unks=[%d, %d, %d, %d, %d] -> %s\n",
+                (int)pmdt->len, width, height, unknown0, unknown1, unknown2,
                 unknown3, unknown4, filename.c_str());
 
-        if (pmdt->content.size() != width * height) {
-            priv2::fail("Unexpected data size");
+        if (pmdt->len != width * height) {
+            return priv2::fail("Unexpected data size");
         }
 
-        priv2::gfx::save_png(width, height, (uint8_t *)pmdt->content.data(), filename);
+        return priv2::gfx::save_png(width, height, (uint8_t *)pmdt->buf, filename);
     }
+
+    return true;
 }
 
-void
-IFF::handle_form(const std::string &path_sig, const std::string &sig,
+bool
+IFF::handle_form(const priv2::path::Path &form_path, const std::string &path_sig, priv2::FourCC sig,
         uint32_t offset,
-        const char *form_buf, size_t form_len)
+        const char *form_buf, size_t form_len, bool root)
 {
     uint32_t *read_ptr = (uint32_t *)form_buf;
 
-    if (sig != "FORM") {
-        priv2::fail("Expected FORM chunk here");
+    if (sig != "FORM"_cc) {
+        return priv2::fail("Expected FORM chunk here");
     }
 
-    auto form_sig = priv2::fourcc(*read_ptr++);
+    priv2::FourCC form_sig(*read_ptr++);
 
-    printf("Form Signature: '%s'\n", form_sig.c_str());
+    auto form_mode = priv2::filter::check(form_path);
+    if (form_mode == priv2::filter::SKIP) {
+        return true;
+    }
 
-    Form form(form_sig);
+    priv2::log::verbose("Form Signature: '%s'\n", form_sig.str().c_str());
 
-    while ((char *)read_ptr < form_buf + form_len) {
-        auto local_sig = priv2::fourcc(*read_ptr++);
-        uint32_t local_len = priv2::byteswap(*read_ptr++);
-        char *local_buf = (char *)read_ptr;
-        char *content_buf = local_buf;
-        uint32_t content_len = local_len;
+    // Outputs of the form go next to its chunks in the tree layout
+    Form form(form_sig, priv2::path::Path(filename_prefix, nullptr, form_path, nullptr));
 
-        if (local_len == 0) {
-            priv2::fail("Zero length chunk, there's probably something wrong with parsing");
+    // Walk the chunk headers first, so that each chunk can be
+    // decompressed and decoded in its own task
+    std::vector<priv2::iff::Node> nodes;
+    if (!read_chunks(form_buf, form_len, offset, priv2::iff::NO_NODE, nodes)) {
+        return false;
+    }
+    auto names = chunk_names(nodes, 0, nodes.size());
+
+    std::vector<ChunkRef> refs;
+    for (size_t i=0; i<nodes.size(); i++) {
+        refs.emplace_back(nodes[i].sig, (char *)form_buf + (nodes[i].offset - offset), nodes[i].length);
+        refs.back().name = names[i];
+        if (is_retained(form_sig, refs.back().sig)) {
+            refs.back().retained = form.add_chunk(refs.back().sig);
         }
+    }
 
-        bool deflate_compressed = priv2::deflate::is_compressed(local_buf, local_len);
-        bool fb10_compressed = priv2::fb10::is_compressed(local_buf, local_len);
+    // Complete-form handlers need the contents of their chunks, so these
+    // chunks are not work units of the journal, and are not filtered out
+    bool complete_form = is_complete_form(form_sig);
+    bool journaled = !complete_form;
 
-        printf("Local Signature: path='%s', sig='%s', len=%d, deflate=%s, fb10=%s\n",
-                path_sig.c_str(), local_sig.c_str(),
-                local_len, deflate_compressed ? "true" : "false",
-                fb10_compressed ? "true" : "false");
+    // Chunks are journaled by the tree path of the form and their offset in
+    // it, as offsets below compressed chunks are not unique in the file
+    std::string journal_key = (journaled && priv2::journal::enabled()) ? form.path.tree() : "";
 
-        std::vector<char> tmp;
+    priv2::task::Group group;
+    for (size_t i=0; i<refs.size(); i++) {
+        uint32_t chunk_offset = offset + refs[i].buf - form_buf;
 
-        if (fb10_compressed) {
-            tmp = priv2::fb10::decompress(local_buf, local_len);
-            content_buf = tmp.data();
-            content_len = tmp.size();
-        } else if (deflate_compressed) {
-            tmp = priv2::deflate::decompress(local_buf, local_len);
-            content_buf = tmp.data();
-            content_len = tmp.size();
-        } else {
-            tmp.resize(local_len);
-            memcpy(tmp.data(), local_buf, local_len);
+        // Offsets below compressed chunks are not file offsets, and may be
+        // those of other units; nested chunks go with the unit they are in
+        if (root && !priv2::shard::owns(key, chunk_offset)) {
+            continue;
+        }
+
+        priv2::path::Path basename(filename_prefix, chunk_offset, path_sig.c_str(), form_sig, refs[i].sig,
+                form.path, refs[i].name.c_str());
+
+        // Checked before the chunk is decompressed
+        auto mode = priv2::filter::check(basename);
+        if (mode == priv2::filter::SKIP && !(complete_form && form_mode == priv2::filter::INCLUDE)) {
+            continue;
+        }
+
+        if (journaled && priv2::journal::done(journal_key, refs[i].buf - form_buf)) {
+            priv2::log::verbose("Skipping finished chunk: sig='%s', offset=%#010x\n",
+                    refs[i].sig.str().c_str(), chunk_offset);
+            continue;
         }
 
-        handle_chunk(path_sig, form_sig, local_sig, offset + local_buf - form_buf, content_buf, content_len);
+        // Peak memory of the task (--mem-limit): the decompressed chunk (in a
+        // pool buffer), and about as much again for what is decoded from it
+        size_t memory = priv2::fb10::uncompressed_size(refs[i].buf, refs[i].len);
+        if (memory == 0) {
+            memory = priv2::deflate::uncompressed_size(refs[i].buf, refs[i].len);
+        }
+        memory = priv2::pool::capacity(memory) + std::max<size_t>(memory, refs[i].len);
+
+        group.spawn([this, &path_sig, &form_sig, &form, &refs, &journal_key, i, offset, form_buf, journaled, mode, basename] () {
+            bool ok = priv2::unit::run(basename, offset + (refs[i].buf - form_buf), [&] () {
+                auto &local_sig = refs[i].sig;
+                char *local_buf = refs[i].buf;
+                uint32_t local_len = refs[i].len;
+                char *content_buf = local_buf;
+                uint32_t content_len = local_len;
+
+                bool deflate_compressed = priv2::deflate::is_compressed(local_buf, local_len);
+                bool fb10_compressed = priv2::fb10::is_compressed(local_buf, local_len);
+
+                priv2::log::verbose("Local Signature: path='%s', sig='%s', len=%d, deflate=%s, fb10=%s\n",
+                        path_sig.c_str(), local_sig.str().c_str(),
+                        local_len, deflate_compressed ? "true" : "false",
+                        fb10_compressed ? "true" : "false");
+
+                // Decompressed into memory used by earlier chunks on this thread
+                priv2::pool::Buffer tmp(fb10_compressed ? priv2::fb10::uncompressed_size(local_buf, local_len) :
+                        deflate_compressed ? priv2::deflate::uncompressed_size(local_buf, local_len) : 0);
+
+                if (fb10_compressed) {
+                    if (!priv2::fb10::decompress(local_buf, local_len, *tmp)) {
+                        return;
+                    }
+                    content_buf = tmp->data();
+                    content_len = tmp->size();
+                } else if (deflate_compressed) {
+                    if (!priv2::deflate::decompress(local_buf, local_len, *tmp)) {
+                        return;
+                    }
+                    content_buf = tmp->data();
+                    content_len = tmp->size();
+                }
 
-        form.chunks.emplace_back(local_sig, std::move(tmp));
+                if (!handle_chunk(basename, path_sig, form_sig, local_sig, mode,
+                            offset + local_buf - form_buf, content_buf, content_len)) {
+                    return;
+                }
 
-        read_ptr = (uint32_t *)(local_buf + local_len + (local_len % 2));
+                // Everything else is freed when the task is done
+                int retained = refs[i].retained;
+                if (retained != -1) {
+                    if (tmp->empty()) {
+                        form.chunks[retained].set(content_buf, content_len);
+                    } else {
+                        form.chunks[retained].set(std::move(*tmp));
+                    }
+                }
+
+                if (journaled && mode == priv2::filter::INCLUDE) {
+                    priv2::journal::commit(journal_key, local_buf - form_buf);
+                }
+            });
+
+            if (!ok && refs[i].retained != -1) {
+                form.chunks[refs[i].retained].failed = true;
+            }
+        }, memory);
+    }
+
+    // Complete-form handlers only need the chunks of this form
+    group.wait();
+
+    // Complete-form handlers need all of the retained chunks
+    auto missing = form.missing_chunk();
+    if (form_mode == priv2::filter::INCLUDE && missing != nullptr) {
+        priv2::log::warning("Skipping form '%s', its %s chunk %s\n", form.path.str().c_str(),
+                missing->sig.str().c_str(), missing->failed ? "failed" : "was not handled");
+    } else if (form_mode == priv2::filter::INCLUDE) {
+        priv2::unit::run(form.path, offset, [this, &form] () {
+            handle_complete_form(form);
+        });
     }
 
-    handle_complete_form(form);
+    // Failures of the chunks and of the complete form are their own
+    return true;
 }
 
 bool IFF::is_iff()
 {
-    uint32_t *read_ptr = (uint32_t *)buf;
-    auto sig = priv2::fourcc(*read_ptr++);
-    return (len >= 8 && sig == "FORM");
+    return priv2::iff::is_iff(buf, len);
 }
 
-void IFF::parse()
+bool IFF::parse()
 {
     if (!is_iff()) {
-        priv2::fail("Not an IFF");
+        return priv2::fail("Not an IFF");
     }
 
     uint32_t *read_ptr = (uint32_t *)buf;
 
-    auto sig = priv2::fourcc(*read_ptr++);
+    priv2::FourCC sig(*read_ptr++);
 
     uint32_t local_len = priv2::byteswap(*read_ptr++);
     char *local_buf = (char *)read_ptr;
@@ -473,21 +824,31 @@ void IFF::parse()
     uint32_t max_local_len = len - HEADER_SIZE;
     if (local_len > max_local_len) {
         // Seen for some files matching MISSION?.IFF where local_len = 0x04000000
-        printf("Local length is 0x%08x (%d bytes); setting to %d bytes (= remaining bytes in file)\n",
+        priv2::log::warning("Local length is 0x%08x (%d bytes); setting to %d bytes (= remaining bytes in file)\n",
                 local_len, local_len, max_local_len);
 
         local_len = max_local_len;
     }
 
-    printf("Starting to parse file with sig '%s', expected length = 0x%08x\n", sig.c_str(), local_len);
+    priv2::log::verbose("Starting to parse file with sig '%s', expected length = 0x%08x\n", sig.str().c_str(), local_len);
+
+    // The root form is named by its form type, like nested forms
+    auto root_path = filename_prefix.child((local_len >= 4 ? priv2::FourCC(*read_ptr) : sig).str());
+    if (!handle_form(root_path, "", sig, offset, local_buf, local_len, true)) {
+        return false;
+    }
 
-    handle_form("", sig, offset, local_buf, local_len);
     int32_t trailing = len - local_len - HEADER_SIZE;
-    if (trailing > 0) {
-        printf("Also writing unhandled trailing %u bytes\n", trailing);
-        priv2::write_file(buf + len - trailing, trailing,
-                "%s-chunk-%#010x-taildata.bin", filename_prefix.c_str(), len - trailing);
+    if (trailing > 0 && priv2::shard::owns(key, len - trailing)) {
+        auto tail = filename_prefix.child(priv2::format("chunk-%#010x-taildata.bin", len - trailing));
+        if (priv2::filter::check(tail) == priv2::filter::INCLUDE && !priv2::journal::done(key, len - trailing)) {
+            priv2::log::info("Also writing unhandled trailing %u bytes\n", trailing);
+            priv2::write_file(buf + len - trailing, trailing, "%s", tail.str().c_str());
+            priv2::journal::commit(key, len - trailing);
+        }
     }
+
+    return true;
 }
 
 };
@@ -498,15 +859,171 @@ namespace iff {
 bool
 is_iff(const char *buf, size_t len)
 {
-    return IFF(buf, len, "").is_iff();
+    return (len >= 8 && priv2::FourCC(*(uint32_t *)buf) == "FORM"_cc);
 }
 
-void
-handle_iff(const char *buf, size_t len, const std::string &filename_prefix)
+bool
+handle_iff(const char *buf, size_t len, const priv2::path::Path &filename_prefix)
 {
     IFF iff(buf, len, filename_prefix);
-    iff.parse();
+    return iff.parse();
+}
+
+std::string
+Index::name(uint32_t node) const
+{
+    uint32_t parent = nodes[node].parent;
+    if (parent == NO_NODE) {
+        return chunk_names(nodes, node, 1)[0];
+    }
+
+    auto &p = nodes[parent];
+    return chunk_names(nodes, p.first_child, p.child_count)[node - p.first_child];
+}
+
+std::vector<std::string>
+Index::child_names(uint32_t node) const
+{
+    return chunk_names(nodes, nodes[node].first_child, nodes[node].child_count);
 }
 
+std::string
+Index::path(uint32_t node) const
+{
+    std::string result = name(node);
+    while ((node = nodes[node].parent) != NO_NODE) {
+        result = name(node) + "/" + result;
+    }
+
+    return result;
+}
+
+uint32_t
+Index::find(const std::string &path)
+{
+    uint32_t node = 0;
+    size_t pos = 0;
+    while (true) {
+        size_t end = path.find('/', pos);
+        auto component = path.substr(pos, end - pos);
+
+        uint32_t first = 0;
+        uint32_t count = 1;
+        if (pos != 0) {
+            // The chunks of a compressed FORM are only read when needed
+            if (nodes[node].sig == "FORM"_cc && nodes[node].compression != UNCOMPRESSED && !expanded.count(node)) {
+                auto &data = expanded[node];
+                data = content(node);
+
+                uint32_t children = nodes.size();
+                if (data.size() >= 4) {
+                    read_chunks(data.data(), data.size(), nodes[node].offset, node, nodes);
+                }
+                nodes[node].first_child = children;
+                nodes[node].child_count = nodes.size() - children;
+                add_children(children);
+            }
+
+            first = nodes[node].first_child;
+            count = nodes[node].child_count;
+        }
+
+        auto names = chunk_names(nodes, first, count);
+        node = NO_NODE;
+        for (uint32_t i=0; i<count; i++) {
+            if (names[i] == component) {
+                node = first + i;
+                break;
+            }
+        }
+
+        if (node == NO_NODE || end == std::string::npos) {
+            return node;
+        }
+
+        pos = end + 1;
+    }
+}
+
+const char *
+Index::payload(uint32_t node) const
+{
+    // In the decompressed data of the nearest compressed FORM, if any
+    for (uint32_t p = nodes[node].parent; p != NO_NODE; p = nodes[p].parent) {
+        auto it = expanded.find(p);
+        if (it != expanded.end()) {
+            return it->second.data() + (nodes[node].offset - nodes[p].offset);
+        }
+    }
+
+    return buf + nodes[node].offset;
+}
+
+std::vector<char>
+Index::content(uint32_t node) const
+{
+    auto &n = nodes[node];
+    char *payload = (char *)this->payload(node);
+
+    switch (n.compression) {
+        case FB10:
+            return priv2::fb10::decompress(payload, n.length);
+        case DEFLATE:
+            return priv2::deflate::decompress(payload, n.length);
+        default:
+            return std::vector<char>(payload, payload + n.length);
+    }
+}
+
+Index
+index(const char *buf, size_t len)
+{
+    if (!is_iff(buf, len)) {
+        priv2::fail("Not an IFF");
+    }
+
+    constexpr uint32_t HEADER_SIZE = sizeof(uint32_t) * 2;
+
+    // Same clamping of the root FORM length as in IFF::parse()
+    Node root;
+    root.sig = FourCC(((uint32_t *)buf)[0]);
+    root.length = std::min<uint32_t>(priv2::byteswap(((uint32_t *)buf)[1]), len - HEADER_SIZE);
+    root.offset = HEADER_SIZE;
+    root.compression = UNCOMPRESSED;
+    root.type = FourCC((root.length >= 4) ? ((uint32_t *)buf)[2] : 0);
+    root.parent = NO_NODE;
+    root.first_child = 0;
+    root.child_count = 0;
+
+    Index result;
+    result.buf = buf;
+    result.len = len;
+    result.nodes.push_back(root);
+    result.add_children(0);
+
+    return result;
+}
+
+void
+Index::add_children(uint32_t first)
+{
+    // The children of each form are added in one go, so they are
+    // consecutive; nested forms are expanded after that
+    for (uint32_t i=first; i<nodes.size(); i++) {
+        auto node = nodes[i];
+        if (node.type == FourCC()) {
+            continue;
+        }
+
+        uint32_t children = nodes.size();
+        read_chunks(payload(i), node.length, node.offset, i, nodes);
+        nodes[i].first_child = children;
+        nodes[i].child_count = nodes.size() - children;
+    }
+}
+
+static priv2::handler::Format
+iff_format("iff", "Handled as IFF", priv2::handler::Format::CONTAINER, "FORM"_cc, is_iff, handle_iff);
+
 };
 };
@@ -17,14 +17,90 @@
 
 #pragma once
 
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+
+#include "priv2.h"
+#include "path.h"
+
 namespace priv2 {
 namespace iff {
 
+enum Compression {
+    UNCOMPRESSED,
+    DEFLATE,
+    FB10,
+};
+
+/**
+ * Header of a chunk, as found in the file (payloads are not decompressed).
+ **/
+struct Node {
+    // Chunk signature, and form type for (uncompressed) FORM chunks (or 0)
+    priv2::FourCC sig;
+    priv2::FourCC type;
+
+    // Offset of the payload in the buffer (below a compressed FORM: offset
+    // of the FORM plus that in its decompressed data), and stored length
+    uint32_t offset;
+    uint32_t length;
+    Compression compression;
+
+    // Indices of the parent (or NO_NODE) and children (consecutive) in Index::nodes
+    uint32_t parent;
+    uint32_t first_child;
+    uint32_t child_count;
+};
+
+constexpr uint32_t NO_NODE = 0xFFFFFFFF;
+
+/**
+ * Tree of the chunk headers of an IFF file, node 0 being the root FORM.
+ * Only the headers are read to build it; a compressed FORM has no children
+ * until find() looks up a path below it, and other payloads are only
+ * decompressed when asked for with content(). Nodes are named like in the
+ * tree layout (e.g. ROOM/0008/BASE).
+ **/
+struct Index {
+    // Name of the node within its parent
+    std::string name(uint32_t node) const;
+
+    // Names of the children of the node
+    std::vector<std::string> child_names(uint32_t node) const;
+
+    // Path of the node, starting with the name of the root FORM
+    std::string path(uint32_t node) const;
+
+    // Look up a node by path, returns NO_NODE if not found; compressed
+    // FORMs on the way are decompressed and their chunks added
+    uint32_t find(const std::string &path);
+
+    // Payload of the node, as stored
+    const char *payload(uint32_t node) const;
+
+    // Payload of the node, decompressed
+    std::vector<char> content(uint32_t node) const;
+
+    const char *buf;
+    size_t len;
+    std::vector<Node> nodes;
+
+    // Decompressed payloads of the compressed FORMs added by find()
+    std::map<uint32_t, std::vector<char>> expanded;
+
+    // Add the chunks of the forms from node <first> on
+    void add_children(uint32_t first);
+};
+
+Index index(const char *buf, size_t len);
+
 bool
 is_iff(const char *buf, size_t len);
 
-void
-handle_iff(const char *buf, size_t len, const std::string &filename_prefix);
+bool
+handle_iff(const char *buf, size_t len, const priv2::path::Path &filename_prefix);
 
 };
 };
@@ -0,0 +1,142 @@
+/*
+ * Privateer 2: The Darkening -- Data Dumper
+ * Copyright (c) 2016, 2017, Thomas Perl
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "input.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <mutex>
+
+#include "priv2.h"
+
+namespace {
+
+// Open memory-mapped input files, for priv2::input::find()
+std::mutex
+files_mutex;
+
+std::vector<std::weak_ptr<priv2::input::File>>
+files;
+
+}; // end anonymous namespace
+
+namespace priv2 {
+namespace input {
+
+File::File()
+    : fd(-1)
+    , ptr(nullptr)
+    , len(0)
+    , mapped(0)
+    , buffer()
+{
+}
+
+File::~File()
+{
+    if (mapped) {
+        munmap((void *)ptr, mapped);
+    }
+
+    if (fd != -1) {
+        close(fd);
+    }
+}
+
+std::shared_ptr<File>
+open(const std::string &filename)
+{
+    std::shared_ptr<File> result(new File());
+
+    result->fd = ::open(filename.c_str(), O_RDONLY);
+    if (result->fd == -1) {
+        priv2::fail(priv2::format("Could not open file: %s", filename.c_str()));
+        return nullptr;
+    }
+
+    struct stat st;
+    if (fstat(result->fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        size_t page_size = sysconf(_SC_PAGESIZE);
+        size_t len = st.st_size;
+
+        // Reserve one zero-filled page more than needed, so that parsers
+        // reading a few bytes past the end do not fault at a page boundary
+        size_t mapped = (len / page_size + 2) * page_size;
+        void *reserved = mmap(nullptr, mapped, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (reserved != MAP_FAILED) {
+            void *ptr = mmap(reserved, len, PROT_READ, MAP_PRIVATE | MAP_FIXED, result->fd, 0);
+            if (ptr != MAP_FAILED) {
+                madvise(ptr, len, MADV_SEQUENTIAL);
+                madvise(ptr, len, MADV_WILLNEED);
+
+                result->ptr = (const char *)ptr;
+                result->len = len;
+                result->mapped = mapped;
+
+                std::lock_guard<std::mutex> lock(files_mutex);
+                for (auto it = files.begin(); it != files.end(); ) {
+                    it = it->expired() ? files.erase(it) : it + 1;
+                }
+                files.emplace_back(result);
+
+                return result;
+            }
+
+            munmap(reserved, mapped);
+        }
+    }
+
+    // Fallback for pipes and anything else that can't be mapped
+    auto &buffer = result->buffer;
+    size_t pos = 0;
+    while (true) {
+        buffer.resize(pos + 64 * 1024);
+        ssize_t count = read(result->fd, buffer.data() + pos, buffer.size() - pos);
+        if (count < 0) {
+            priv2::fail(priv2::format("Could not read file: %s", filename.c_str()));
+            return nullptr;
+        } else if (count == 0) {
+            break;
+        }
+        pos += count;
+    }
+    buffer.resize(pos);
+
+    result->ptr = buffer.data();
+    result->len = buffer.size();
+    return result;
+}
+
+std::shared_ptr<File>
+find(const char *ptr, size_t len)
+{
+    std::lock_guard<std::mutex> lock(files_mutex);
+    for (auto &weak: files) {
+        auto file = weak.lock();
+        if (file && ptr >= file->ptr && ptr + len <= file->ptr + file->len) {
+            return file;
+        }
+    }
+
+    return nullptr;
+}
+
+};
+};
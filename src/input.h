@@ -0,0 +1,63 @@
+/*
+ * Privateer 2: The Darkening -- Data Dumper
+ * Copyright (c) 2016, 2017, Thomas Perl
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+
+namespace priv2 {
+namespace input {
+
+/**
+ * Contents of an input file. Regular files are memory-mapped read-only,
+ * so the data is paged in from the page cache as the parsers walk over it
+ * instead of being copied into a buffer first. Anything that cannot be
+ * mapped (pipes, character devices) is read into memory.
+ **/
+struct File {
+    File();
+    ~File();
+
+    const char *data() const { return ptr; }
+    size_t size() const { return len; }
+
+    int fd;
+    const char *ptr;
+    size_t len;
+
+    // Size of the mapping (0 if the contents were read into "buffer")
+    size_t mapped;
+    std::vector<char> buffer;
+};
+
+/**
+ * Open an input file, fails (and returns nullptr) if it can't be read.
+ **/
+std::shared_ptr<File> open(const std::string &filename);
+
+/**
+ * Find the open, memory-mapped input file that contains the given range,
+ * so that it can be copied from the file descriptor instead of from memory.
+ * Returns nullptr if the range is not part of a mapped input file (e.g. it
+ * was decompressed, or the input was read from a pipe).
+ **/
+std::shared_ptr<File> find(const char *ptr, size_t len);
+
+};
+};
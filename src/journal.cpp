@@ -0,0 +1,154 @@
+/*
+ * Privateer 2: The Darkening -- Data Dumper
+ * Copyright (c) 2016, 2017, Thomas Perl
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "journal.h"
+
+#include <stdio.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <unordered_set>
+
+#include "priv2.h"
+#include "log.h"
+#include "output.h"
+#include "stats.h"
+#include "unit.h"
+
+namespace {
+
+int
+journal_fd = -1;
+
+// Units finished in earlier runs (read-only after open)
+std::unordered_set<std::string>
+finished;
+
+priv2::stats::Counter
+units_skipped("Journal units skipped (resume)");
+
+priv2::stats::Counter
+units_committed("Journal units committed");
+
+std::string
+record(const std::string &filename, uint32_t offset)
+{
+    return priv2::format("%08x %s", offset, filename.c_str());
+}
+
+}; // end anonymous namespace
+
+namespace priv2 {
+namespace journal {
+
+void
+open(const std::string &filename)
+{
+    journal_fd = ::open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+    if (journal_fd == -1) {
+        priv2::fail(priv2::format("Could not open journal: %s", filename.c_str()));
+    }
+
+    std::string contents;
+    char buf[64 * 1024];
+    ssize_t count;
+    while ((count = read(journal_fd, buf, sizeof(buf))) > 0) {
+        contents.append(buf, count);
+    }
+
+    // Only complete lines count, a partial one from an interrupted
+    // append is cut off so that new records start on a fresh line
+    size_t valid = contents.rfind('\n');
+    valid = (valid == std::string::npos) ? 0 : valid + 1;
+
+    size_t pos = 0;
+    while (pos < valid) {
+        size_t end = contents.find('\n', pos);
+        finished.insert(contents.substr(pos, end - pos));
+        pos = end + 1;
+    }
+
+    if (ftruncate(journal_fd, valid) != 0 || lseek(journal_fd, valid, SEEK_SET) == -1) {
+        priv2::fail(priv2::format("Could not open journal: %s", filename.c_str()));
+    }
+
+    if (!finished.empty()) {
+        priv2::log::info("Resuming, %zu units finished earlier\n", finished.size());
+    }
+}
+
+bool
+enabled()
+{
+    return journal_fd != -1;
+}
+
+bool
+done(const std::string &filename, uint32_t offset)
+{
+    if (journal_fd == -1 || !finished.count(record(filename, offset))) {
+        return false;
+    }
+
+    units_skipped.add(1);
+    return true;
+}
+
+void
+commit(const std::string &filename, uint32_t offset)
+{
+    // A unit with a failed task is done again by the next run
+    if (journal_fd == -1 || priv2::unit::failed()) {
+        return;
+    }
+
+    priv2::output::mark(record(filename, offset));
+}
+
+void
+append(const std::vector<std::string> &records)
+{
+    std::string tmp;
+    for (auto &line: records) {
+        tmp += line + "\n";
+    }
+
+    size_t pos = 0;
+    while (pos < tmp.size()) {
+        ssize_t count = write(journal_fd, tmp.data() + pos, tmp.size() - pos);
+        if (count <= 0) {
+            priv2::fail("Could not write journal");
+        }
+        pos += count;
+    }
+
+    fdatasync(journal_fd);
+    units_committed.add(records.size());
+}
+
+void
+close()
+{
+    if (journal_fd != -1) {
+        ::close(journal_fd);
+        journal_fd = -1;
+    }
+}
+
+};
+};
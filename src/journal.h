@@ -0,0 +1,60 @@
+/*
+ * Privateer 2: The Darkening -- Data Dumper
+ * Copyright (c) 2016, 2017, Thomas Perl
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace priv2 {
+namespace journal {
+
+/**
+ * Keep a journal of finished work units in the given file (--resume).
+ * Units recorded in the journal by an earlier run are skipped.
+ **/
+void open(const std::string &filename);
+
+/**
+ * Check if a journal is kept, so that keys are only rendered when needed.
+ **/
+bool enabled();
+
+/**
+ * Check if the work unit at <offset> of <filename> has been finished in an
+ * earlier run. <filename> names the container the offset is relative to,
+ * and must be unique for it (e.g. the tree path of a nested IFF form).
+ **/
+bool done(const std::string &filename, uint32_t offset);
+
+/**
+ * Record the unit as finished. Call when all of its outputs have been
+ * submitted: the record is written once those are on disk.
+ **/
+void commit(const std::string &filename, uint32_t offset);
+
+/**
+ * Append records to the journal and flush it to disk (used by the output
+ * writer after syncing the output files the records refer to).
+ **/
+void append(const std::vector<std::string> &records);
+
+void close();
+
+};
+};
@@ -0,0 +1,238 @@
+/*
+ * Privateer 2: The Darkening -- Data Dumper
+ * Copyright (c) 2016, 2017, Thomas Perl
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "kernel.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PRIV2_KERNEL_X86
+#include <immintrin.h>
+#endif
+
+namespace {
+
+struct Kernels {
+    void (*expand_palette)(const uint32_t *colors, const uint8_t *indices, uint32_t *out, size_t count);
+    size_t (*printable_run)(const char *buf, size_t len);
+    void (*copy_match)(char *dst, size_t distance, size_t count);
+};
+
+void
+expand_palette_scalar(const uint32_t *colors, const uint8_t *indices, uint32_t *out, size_t count)
+{
+    for (size_t i=0; i<count; i++) {
+        out[i] = colors[indices[i]];
+    }
+}
+
+size_t
+printable_run_scalar(const char *buf, size_t len)
+{
+    size_t i = 0;
+    while (i < len && (uint8_t)buf[i] > 31 && (uint8_t)buf[i] < 127) {
+        i++;
+    }
+    return i;
+}
+
+void
+copy_match_scalar(char *dst, size_t distance, size_t count)
+{
+    const char *src = dst - distance;
+    for (size_t i=0; i<count; i++) {
+        dst[i] = src[i];
+    }
+}
+
+#if defined(PRIV2_KERNEL_X86)
+
+__attribute__((target("sse4.2"))) size_t
+printable_run_sse42(const char *buf, size_t len)
+{
+    // Find the first byte outside of 0x20..0x7e (or the end of the string)
+    const __m128i range = _mm_setr_epi8(0x20, 0x7e, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+
+    size_t i = 0;
+    while (i + 16 <= len) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(buf + i));
+        int index = _mm_cmpistri(range, chunk, _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES |
+                _SIDD_NEGATIVE_POLARITY | _SIDD_LEAST_SIGNIFICANT);
+        if (index < 16) {
+            return i + index;
+        }
+        i += 16;
+    }
+
+    return i + printable_run_scalar(buf + i, len - i);
+}
+
+__attribute__((target("sse4.2"))) void
+copy_match_sse42(char *dst, size_t distance, size_t count)
+{
+    // 16 bytes at a time, if these do not overlap what is being written
+    size_t i = 0;
+    if (distance >= 16) {
+        const char *src = dst - distance;
+        for (; i + 16 <= count; i += 16) {
+            _mm_storeu_si128((__m128i *)(dst + i), _mm_loadu_si128((const __m128i *)(src + i)));
+        }
+    }
+
+    copy_match_scalar(dst + i, distance, count - i);
+}
+
+__attribute__((target("avx2"))) void
+expand_palette_avx2(const uint32_t *colors, const uint8_t *indices, uint32_t *out, size_t count)
+{
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i index = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(indices + i)));
+        __m256i color = _mm256_i32gather_epi32((const int *)colors, index, 4);
+        _mm256_storeu_si256((__m256i *)(out + i), color);
+    }
+
+    expand_palette_scalar(colors, indices + i, out + i, count - i);
+}
+
+__attribute__((target("avx2"))) size_t
+printable_run_avx2(const char *buf, size_t len)
+{
+    // Signed compares: bytes >= 0x80 are below 0x20 as well
+    const __m256i low = _mm256_set1_epi8(0x1f);
+    const __m256i high = _mm256_set1_epi8(0x7f);
+
+    size_t i = 0;
+    while (i + 32 <= len) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)(buf + i));
+        __m256i printable = _mm256_and_si256(_mm256_cmpgt_epi8(chunk, low), _mm256_cmpgt_epi8(high, chunk));
+        uint32_t mask = ~(uint32_t)_mm256_movemask_epi8(printable);
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+        i += 32;
+    }
+
+    return i + printable_run_sse42(buf + i, len - i);
+}
+
+__attribute__((target("avx2"))) void
+copy_match_avx2(char *dst, size_t distance, size_t count)
+{
+    size_t i = 0;
+    if (distance >= 32) {
+        const char *src = dst - distance;
+        for (; i + 32 <= count; i += 32) {
+            _mm256_storeu_si256((__m256i *)(dst + i), _mm256_loadu_si256((const __m256i *)(src + i)));
+        }
+    }
+
+    copy_match_sse42(dst + i, distance, count - i);
+}
+
+#endif
+
+// Indexed by level
+const Kernels
+KERNELS[] = {
+    { expand_palette_scalar, printable_run_scalar, copy_match_scalar },
+#if defined(PRIV2_KERNEL_X86)
+    { expand_palette_scalar, printable_run_sse42, copy_match_sse42 },
+    { expand_palette_avx2, printable_run_avx2, copy_match_avx2 },
+#endif
+};
+
+const char *
+NAMES[] = { "scalar", "sse4.2", "avx2" };
+
+priv2::kernel::Level
+current_level = priv2::kernel::SCALAR;
+
+const Kernels *
+current = &KERNELS[priv2::kernel::SCALAR];
+
+}; // end anonymous namespace
+
+namespace priv2 {
+namespace kernel {
+
+Level
+detect()
+{
+#if defined(PRIV2_KERNEL_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return AVX2;
+    } else if (__builtin_cpu_supports("sse4.2")) {
+        return SSE42;
+    }
+#endif
+
+    return SCALAR;
+}
+
+void
+select(Level level)
+{
+    current_level = level;
+    current = &KERNELS[level];
+}
+
+Level
+selected()
+{
+    return current_level;
+}
+
+const char *
+name(Level level)
+{
+    return NAMES[level];
+}
+
+bool
+parse(const char *name, Level &result)
+{
+    for (int i=SCALAR; i<=AVX2; i++) {
+        if (strcmp(name, NAMES[i]) == 0) {
+            result = (Level)i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void
+expand_palette(const uint32_t *colors, const uint8_t *indices, uint32_t *out, size_t count)
+{
+    current->expand_palette(colors, indices, out, count);
+}
+
+size_t
+printable_run(const char *buf, size_t len)
+{
+    return current->printable_run(buf, len);
+}
+
+void
+copy_match(char *dst, size_t distance, size_t count)
+{
+    current->copy_match(dst, distance, count);
+}
+
+};
+};
@@ -0,0 +1,75 @@
+/*
+ * Privateer 2: The Darkening -- Data Dumper
+ * Copyright (c) 2016, 2017, Thomas Perl
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+namespace priv2 {
+namespace kernel {
+
+/**
+ * Instruction set of the byte loops. Each kernel has a scalar version,
+ * and versions for the levels where vector instructions pay off; the
+ * best one up to the selected level is used.
+ **/
+enum Level {
+    SCALAR = 0,
+    SSE42 = 1,
+    AVX2 = 2,
+};
+
+/**
+ * Best level supported by the CPU (and this build).
+ **/
+Level detect();
+
+/**
+ * Use the kernels of <level>, at startup before any kernel runs. Levels
+ * below the detected one can be chosen for benchmarks (--cpu).
+ **/
+void select(Level level);
+
+Level selected();
+
+const char *name(Level level);
+
+/**
+ * Parse a level name ("scalar", "sse4.2" or "avx2").
+ **/
+bool parse(const char *name, Level &level);
+
+/**
+ * Expand 8-bit color indices to 32-bit colors of a 256-entry palette.
+ **/
+void expand_palette(const uint32_t *colors, const uint8_t *indices, uint32_t *out, size_t count);
+
+/**
+ * Number of printable ASCII characters (32..126) at the start of <buf>,
+ * looking at most at <len> bytes.
+ **/
+size_t printable_run(const char *buf, size_t len);
+
+/**
+ * Copy <count> bytes from <distance> bytes before <dst> to <dst>, byte by
+ * byte as far as the result goes (so that the ranges can overlap, which
+ * repeats the last <distance> bytes).
+ **/
+void copy_match(char *dst, size_t distance, size_t count);
+
+};
+};
@@ -0,0 +1,234 @@
+/*
+ * Privateer 2: The Darkening -- Data Dumper
+ * Copyright (c) 2016, 2017, Thomas Perl
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "log.h"
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+
+#include <mutex>
+
+namespace {
+
+std::mutex
+console_mutex;
+
+FILE *
+console = stdout;
+
+thread_local priv2::log::Buffer *
+current_buffer = nullptr;
+
+void
+write_console(const char *buf, size_t len)
+{
+    std::lock_guard<std::mutex> lock(console_mutex);
+    fwrite(buf, len, 1, console);
+}
+
+void
+vmessage(const char *fmt, va_list ap)
+{
+    // Most messages are short, those are formatted on the stack
+    char buf[512];
+    char *tmp = buf;
+
+    va_list ap2;
+    va_copy(ap2, ap);
+    int len = vsnprintf(buf, sizeof(buf), fmt, ap);
+    if (len >= (int)sizeof(buf)) {
+        len = vasprintf(&tmp, fmt, ap2);
+    }
+    va_end(ap2);
+
+    if (len < 0) {
+        return;
+    }
+
+    if (current_buffer) {
+        current_buffer->append(tmp, len);
+    } else {
+        write_console(tmp, len);
+    }
+
+    if (tmp != buf) {
+        free(tmp);
+    }
+}
+
+}; // end anonymous namespace
+
+namespace priv2 {
+namespace log {
+
+void
+Buffer::append(const char *buf, size_t len)
+{
+    if (segments.empty() || segments.back().child) {
+        segments.emplace_back();
+    }
+
+    segments.back().text.append(buf, len);
+}
+
+Buffer *
+Buffer::fork()
+{
+    segments.emplace_back();
+    segments.back().child.reset(new Buffer());
+    return segments.back().child.get();
+}
+
+void
+Buffer::flatten(std::string &out) const
+{
+    for (auto &segment: segments) {
+        out += segment.text;
+        if (segment.child) {
+            segment.child->flatten(out);
+        }
+    }
+}
+
+void
+Buffer::clear()
+{
+    segments.clear();
+}
+
+Level
+max_level = INFO;
+
+void
+set_level(Level level)
+{
+    max_level = level;
+}
+
+void
+message(Level level, const char *fmt, ...)
+{
+    if (!enabled(level)) {
+        return;
+    }
+
+    va_list ap;
+    va_start(ap, fmt);
+    vmessage(fmt, ap);
+    va_end(ap);
+}
+
+void
+warning(const char *fmt, ...)
+{
+    if (!enabled(QUIET)) {
+        return;
+    }
+
+    va_list ap;
+    va_start(ap, fmt);
+    vmessage(fmt, ap);
+    va_end(ap);
+}
+
+void
+info(const char *fmt, ...)
+{
+    if (!enabled(INFO)) {
+        return;
+    }
+
+    va_list ap;
+    va_start(ap, fmt);
+    vmessage(fmt, ap);
+    va_end(ap);
+}
+
+void
+verbose(const char *fmt, ...)
+{
+    if (!enabled(VERBOSE)) {
+        return;
+    }
+
+    va_list ap;
+    va_start(ap, fmt);
+    vmessage(fmt, ap);
+    va_end(ap);
+}
+
+void
+debug(const char *fmt, ...)
+{
+    if (!enabled(DEBUG)) {
+        return;
+    }
+
+    va_list ap;
+    va_start(ap, fmt);
+    vmessage(fmt, ap);
+    va_end(ap);
+}
+
+void
+flush()
+{
+    if (current_buffer) {
+        std::string tmp;
+        current_buffer->flatten(tmp);
+        write_console(tmp.data(), tmp.size());
+        current_buffer->clear();
+    }
+}
+
+void
+redirect(FILE *fp)
+{
+    std::lock_guard<std::mutex> lock(console_mutex);
+    fflush(console);
+    console = fp;
+}
+
+Buffer *
+current()
+{
+    return current_buffer;
+}
+
+Buffer *
+swap(Buffer *buffer)
+{
+    Buffer *previous = current_buffer;
+    current_buffer = buffer;
+    return previous;
+}
+
+Group::Group()
+    : buffer()
+    , previous(swap(&buffer))
+{
+}
+
+Group::~Group()
+{
+    flush();
+    swap(previous);
+}
+
+};
+};
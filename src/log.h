@@ -0,0 +1,131 @@
+/*
+ * Privateer 2: The Darkening -- Data Dumper
+ * Copyright (c) 2016, 2017, Thomas Perl
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <stdarg.h>
+
+#include <string>
+#include <vector>
+#include <memory>
+
+namespace priv2 {
+namespace log {
+
+/**
+ * Collected console output. Buffers form a tree: a task spawned from code
+ * that is logging into a buffer gets its own child buffer at that position,
+ * so the collected output reads in program order no matter which thread
+ * ran which part of the work, and in which order the tasks finished.
+ **/
+struct Buffer {
+    void append(const char *buf, size_t len);
+    Buffer *fork();
+    void flatten(std::string &out) const;
+    void clear();
+
+private:
+    struct Segment {
+        std::string text;
+        std::unique_ptr<Buffer> child;
+    };
+
+    std::vector<Segment> segments;
+};
+
+enum Level {
+    // Printed even with -q (warnings, reports asked for)
+    QUIET = 0,
+    // Default: what is done with each file, and what is written
+    INFO = 1,
+    // -v: the structure of containers, cache hits, skipped work
+    VERBOSE = 2,
+    // -vv: details of the decoders (vertices, glyphs, trees, ...)
+    DEBUG = 3,
+};
+
+/**
+ * Only print messages up to the given level.
+ **/
+void set_level(Level level);
+
+extern Level max_level;
+
+/**
+ * Check if messages of the given level are printed, to skip preparing
+ * them (e.g. formatting loops) when they are not.
+ **/
+static inline bool
+enabled(Level level)
+{
+    return level <= max_level;
+}
+
+/**
+ * Print a message to the console, if its level is enabled. While a Group
+ * is active on the calling thread, the message is collected in the group's
+ * buffer instead.
+ **/
+void message(Level level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+void warning(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+void info(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+void verbose(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+void debug(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+/**
+ * Write out the buffer active on the calling thread (if any), used
+ * before bailing out so that the context of an error is not lost.
+ **/
+void flush();
+
+/**
+ * Send console output to the given stream instead of stdout (used when
+ * stdout carries data, e.g. a tar stream).
+ **/
+void redirect(FILE *fp);
+
+/**
+ * Get the buffer active on the calling thread, or nullptr if output goes
+ * straight to the console.
+ **/
+Buffer *current();
+
+/**
+ * Make the given buffer (or nullptr for the console) the active one on
+ * the calling thread, and return the previously active one.
+ **/
+Buffer *swap(Buffer *buffer);
+
+/**
+ * Collects all console output of the current thread (and of the tasks it
+ * spawns) while in scope, and prints it in one piece when going out of
+ * scope, so that the output of files processed in parallel does not get
+ * interleaved.
+ **/
+struct Group {
+    Group();
+    ~Group();
+
+private:
+    Buffer buffer;
+    Buffer *previous;
+};
+
+};
+};
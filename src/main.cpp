@@ -16,20 +16,272 @@
  */
 
 #include "priv2.h"
+#include "log.h"
 
 #include "handler.h"
+#include "task.h"
+#include "memory.h"
+#include "pool.h"
+#include "shard.h"
+#include "input.h"
+#include "output.h"
+#include "stats.h"
+#include "sink.h"
+#include "path.h"
+#include "cache.h"
+#include "journal.h"
+#include "filter.h"
+#include "unit.h"
+#include "big.h"
+#include "iff.h"
+
+// Journal of finished work units (--resume), next to the output files
+static const char *
+JOURNAL_FILENAME = "priv2dump.journal";
+
+/**
+ * Write a single BIG entry or IFF chunk to stdout, either as stored or
+ * decoded (the outputs as tar archive), reading only what is needed.
+ **/
+static int
+cat_entry(const priv2::CLI &cli)
+{
+    if (cli.filenames.size() != 2) {
+        priv2::fail("Usage: cat [--raw] <file> <path>");
+    }
+
+    auto &filename = cli.filenames[0];
+    auto path = cli.filenames[1];
+
+    // The BIG entry (or the whole file), and the path of the chunk in it
+    std::vector<char> entry_data;
+    std::shared_ptr<priv2::input::File> input;
+    const char *buf;
+    size_t len;
+    std::string name;
+
+    auto big = priv2::big::open(filename);
+    if (big) {
+        auto entry = big->find(path);
+        std::string rest;
+
+        size_t pos = path.find('/');
+        if (!entry && pos != std::string::npos) {
+            entry = big->find(path.substr(0, pos));
+            rest = path.substr(pos + 1);
+        }
+
+        if (!entry) {
+            priv2::fail(priv2::format("No such entry: %s", path.c_str()));
+        }
+
+        entry_data = big->read(*entry);
+        buf = entry_data.data();
+        len = entry_data.size();
+        name = entry->filename;
+        path = rest;
+    } else {
+        input = priv2::input::open(filename);
+        buf = input->data();
+        len = input->size();
+        name = priv2::basename(filename);
+    }
+
+    // Below a compressed FORM, raw payloads are in the index
+    priv2::iff::Index index;
+    std::vector<char> content;
+    if (!path.empty()) {
+        if (!priv2::iff::is_iff(buf, len)) {
+            priv2::fail(priv2::format("Not an IFF file: %s", name.c_str()));
+        }
+
+        index = priv2::iff::index(buf, len);
+        uint32_t node = index.find(path);
+        if (node == priv2::iff::NO_NODE) {
+            priv2::fail(priv2::format("No such chunk: %s", path.c_str()));
+        }
+
+        name = priv2::basename(path);
+        if (cli.raw) {
+            buf = index.payload(node);
+            len = index.nodes[node].length;
+        } else {
+            content = index.content(node);
+            buf = content.data();
+            len = content.size();
+        }
+    }
+
+    if (cli.raw) {
+        if (fwrite(buf, len, 1, stdout) != 1 && len > 0) {
+            priv2::fail("Could not write to stdout");
+        }
+        fflush(stdout);
+        return 0;
+    }
+
+    priv2::output::start(new priv2::sink::TarSink(cli.tar.empty() ? "-" : cli.tar));
+    if (priv2::handler::handle_data(buf, len, priv2::path::Path(name)) == priv2::handler::UNKNOWN) {
+        priv2::log::info("Unknown format, writing data as is: '%s'\n", name.c_str());
+        priv2::write_file(buf, len, "%s.bin", name.c_str());
+    }
+    priv2::output::finish();
+
+    return 0;
+}
+
+static void
+list_iff_node(const priv2::iff::Index &index, uint32_t node, const std::string &path)
+{
+    static const char *COMPRESSION[] = { "", " deflate", " fb10" };
+
+    auto &n = index.nodes[node];
+    printf("%s  sig=%s offset=%#010x length=%u%s\n", path.c_str(), n.sig.str().c_str(),
+            n.offset, n.length, COMPRESSION[n.compression]);
+
+    auto names = index.child_names(node);
+    for (uint32_t i=0; i<n.child_count; i++) {
+        list_iff_node(index, n.first_child + i, path + "/" + names[i]);
+    }
+}
+
+static void
+list_iff(const char *buf, size_t len, const std::string &path)
+{
+    auto index = priv2::iff::index(buf, len);
+    list_iff_node(index, 0, path + "/" + index.name(0));
+}
+
+/**
+ * Print the BIG entries and IFF chunks of a file, with their paths in
+ * the tree layout, looking only at the headers.
+ **/
+static void
+list_file(const std::string &filename)
+{
+    auto input = priv2::input::open(filename);
+    auto basename = priv2::basename(filename);
+    const char *buf = input->data();
+    size_t len = input->size();
+
+    if (priv2::big::is_big(buf, len)) {
+        for (auto &entry: priv2::big::read_directory(buf, len)) {
+            auto path = basename + "/" + entry.filename;
+            printf("%s  offset=%#010x length=%u\n", path.c_str(), entry.offset, entry.length);
+
+            if (entry.offset <= len && entry.length <= len - entry.offset &&
+                    priv2::iff::is_iff(buf + entry.offset, entry.length)) {
+                list_iff(buf + entry.offset, entry.length, path);
+            }
+        }
+    } else if (priv2::iff::is_iff(buf, len)) {
+        list_iff(buf, len, basename);
+    } else {
+        printf("%s  length=%zu\n", basename.c_str(), len);
+    }
+}
 
 int
 main(int argc, char *argv[])
 {
     priv2::CLI cli(argc, argv);
+    priv2::memory::set_limit(cli.mem_limit);
+    // Workers, and the main thread (which does the work itself with -j 1)
+    priv2::pool::set_limit(cli.mem_limit, (cli.jobs == 1) ? 1 : cli.jobs + 1);
+    priv2::task::start(cli.jobs);
+    priv2::path::set_layout(cli.tree_layout ? priv2::path::TREE : priv2::path::FLAT);
+
+    if (!cli.cache.empty()) {
+        priv2::cache::open(cli.cache);
+    }
+
+    if (cli.command == "cat") {
+        int result = cat_entry(cli);
+        priv2::task::stop();
+        return result;
+    }
+
+    if (cli.command == "list") {
+        for (auto &filename: cli.filenames) {
+            list_file(filename);
+        }
+        priv2::task::stop();
+        return 0;
+    }
+
+    if (cli.resume) {
+        priv2::journal::open(JOURNAL_FILENAME);
+    }
+
+    if (cli.tar.empty()) {
+        priv2::output::start(new priv2::sink::DirectorySink(cli.resume));
+    } else {
+        priv2::output::start(new priv2::sink::TarSink(cli.tar));
+    }
+
+    if (cli.shard_count > 1) {
+        priv2::shard::plan(cli.filenames, cli.shard_index, cli.shard_count);
+    }
+
+    for (auto &pattern: cli.includes) {
+        priv2::filter::include(pattern);
+    }
+
+    for (auto &pattern: cli.excludes) {
+        priv2::filter::exclude(pattern);
+    }
 
     cli.for_each([] (const std::string &filename, const std::string &basename) {
-        auto buffer = priv2::read_file(filename);
-        if (!priv2::handler::handle_data(buffer.data(), buffer.size(), basename)) {
-            printf("Unknown file ignored: '%s'\n", filename.c_str());
+        if (!priv2::shard::owns(basename, 0)) {
+            priv2::log::verbose("Skipping file of other shard: '%s'\n", filename.c_str());
+            return;
+        }
+
+        auto mode = priv2::filter::check(basename);
+        if (mode == priv2::filter::SKIP) {
+            priv2::log::verbose("Skipping filtered file: '%s'\n", filename.c_str());
+            return;
         }
+
+        if (priv2::journal::done(basename, 0)) {
+            priv2::log::verbose("Skipping finished file: '%s'\n", filename.c_str());
+            return;
+        }
+
+        // Outlive the unit, so that its paths can be reported and the
+        // input file is closed if it fails
+        priv2::path::Arena arena;
+        priv2::path::Path path(arena, basename);
+        std::shared_ptr<priv2::input::File> input;
+
+        priv2::unit::run(path, 0, [&] () {
+            input = priv2::input::open(filename);
+            if (!input) {
+                return;
+            }
+
+            auto result = priv2::handler::handle_data(input->data(), input->size(), path);
+            if (result == priv2::handler::FAILED) {
+                return;
+            } else if (result == priv2::handler::UNKNOWN) {
+                priv2::log::info("Unknown file ignored: '%s'\n", filename.c_str());
+            }
+
+            if (mode == priv2::filter::INCLUDE) {
+                priv2::journal::commit(basename, 0);
+            }
+        });
     });
 
-    return 0;
+    priv2::output::finish();
+    priv2::journal::close();
+    priv2::task::stop();
+
+    size_t failed = priv2::unit::report();
+
+    if (cli.stats) {
+        priv2::stats::report();
+    }
+
+    return (failed > 0) ? 1 : 0;
 }
@@ -0,0 +1,96 @@
+/*
+ * Privateer 2: The Darkening -- Data Dumper
+ * Copyright (c) 2016, 2017, Thomas Perl
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "memory.h"
+#include "stats.h"
+
+#include <mutex>
+
+namespace {
+
+std::mutex
+mutex;
+
+size_t
+limit = 0;
+
+size_t
+reserved = 0;
+
+priv2::stats::Counter
+memory_reserved("Memory reserved by tasks (bytes)", priv2::stats::Counter::PEAK);
+
+priv2::stats::Counter
+memory_deferred("Tasks deferred for memory");
+
+}; // end anonymous namespace
+
+namespace priv2 {
+namespace memory {
+
+void
+set_limit(size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    limit = bytes;
+}
+
+bool
+try_reserve(size_t bytes)
+{
+    if (bytes == 0) {
+        return true;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (limit == 0 || reserved + bytes <= limit || reserved == 0) {
+            reserved += bytes;
+            memory_reserved.add(bytes);
+            return true;
+        }
+    }
+
+    memory_deferred.add(1);
+    return false;
+}
+
+void
+reserve(size_t bytes)
+{
+    if (bytes == 0) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    reserved += bytes;
+    memory_reserved.add(bytes);
+}
+
+void
+release(size_t bytes)
+{
+    if (bytes == 0) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    reserved -= bytes;
+    memory_reserved.add(-(int64_t)bytes);
+}
+
+};
+};
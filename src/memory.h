@@ -0,0 +1,50 @@
+/*
+ * Privateer 2: The Darkening -- Data Dumper
+ * Copyright (c) 2016, 2017, Thomas Perl
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+#pragma once
+
+#include <cstddef>
+
+namespace priv2 {
+namespace memory {
+
+/**
+ * Limit the memory reserved by running tasks to <bytes> (--mem-limit),
+ * 0 for no limit.
+ **/
+void set_limit(size_t bytes);
+
+/**
+ * Reserve the estimated peak memory of a task before it is taken from its
+ * queue. Returns false if the reservation does not fit into the limit now
+ * (unless nothing is reserved at all), so that the scheduler can run other
+ * tasks in the meantime.
+ **/
+bool try_reserve(size_t bytes);
+
+/**
+ * Reserve memory regardless of the limit (for a task that has to run so
+ * that the memory reserved by others can be released).
+ **/
+void reserve(size_t bytes);
+
+/**
+ * Release a reservation when its task is done.
+ **/
+void release(size_t bytes);
+
+};
+};
@@ -24,7 +24,9 @@
 #include <string>
 
 #include "priv2.h"
+#include "log.h"
 #include "movielist.h"
+#include "handler.h"
 
 namespace priv2 {
 namespace movielist {
@@ -40,11 +42,11 @@ is_movielist(const char *buf, size_t len)
     return first_filename.find(".tgv") != std::string::npos;
 }
 
-void
-handle_movielist(const char *buf, size_t len, const std::string &filename_prefix)
+bool
+handle_movielist(const char *buf, size_t len, const priv2::path::Path &filename_prefix)
 {
     if (!is_movielist(buf, len)) {
-        priv2::fail("Not a movie list");
+        return priv2::fail("Not a movie list");
     }
 
     const uint8_t *start_ptr = (const uint8_t *)buf;
@@ -64,9 +66,13 @@ handle_movielist(const char *buf, size_t len, const std::string &filename_prefix
         i++;
     }
 
-    printf("%s\n", lines.c_str());
-    priv2::write_file(lines, "%s-movielist.txt", filename_prefix.c_str());
+    priv2::log::verbose("%s\n", lines.c_str());
+    priv2::write_file(lines, "%s-movielist.txt", filename_prefix.str().c_str());
+    return true;
 }
 
+static priv2::handler::Format
+movielist_format("movielist", "Handled as movie list", 20, is_movielist, handle_movielist);
+
 };
 };
@@ -19,14 +19,16 @@
 
 #include <string>
 
+#include "path.h"
+
 namespace priv2 {
 namespace movielist {
 
 bool
 is_movielist(const char *buf, size_t len);
 
-void
-handle_movielist(const char *buf, size_t len, const std::string &filename_prefix);
+bool
+handle_movielist(const char *buf, size_t len, const priv2::path::Path &filename_prefix);
 
 };
 };
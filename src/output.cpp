@@ -0,0 +1,291 @@
+/*
+ * Privateer 2: The Darkening -- Data Dumper
+ * Copyright (c) 2016, 2017, Thomas Perl
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "output.h"
+
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "stats.h"
+#include "input.h"
+#include "cache.h"
+#include "journal.h"
+
+namespace {
+
+// Limits for queued (not yet written) output
+constexpr size_t MAX_QUEUED_FILES = 4096;
+constexpr size_t MAX_QUEUED_BYTES = 64 * 1024 * 1024;
+
+struct Job {
+    Job(const std::string &filename, std::vector<char> &&data)
+        : filename(filename)
+        , data(std::move(data))
+        , source()
+        , source_buf(nullptr)
+        , source_len(0)
+        , record()
+    {
+    }
+
+    Job(const std::string &filename, std::shared_ptr<priv2::input::File> source,
+            const char *source_buf, size_t source_len)
+        : filename(filename)
+        , data()
+        , source(source)
+        , source_buf(source_buf)
+        , source_len(source_len)
+        , record()
+    {
+    }
+
+    std::string filename;
+    std::vector<char> data;
+
+    // Range of an input file to copy (keeps the input file open)
+    std::shared_ptr<priv2::input::File> source;
+    const char *source_buf;
+    size_t source_len;
+
+    // Journal record (no file is written for this job)
+    std::string record;
+};
+
+struct Writer {
+    Writer(priv2::sink::Sink *sink) : sink(sink), thread(), mutex(), cv(), jobs(), queued_files(0), queued_bytes(0), stopping(false) {}
+
+    void loop();
+
+    std::unique_ptr<priv2::sink::Sink> sink;
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<Job> jobs;
+
+    // Submitted, but not yet written (including the batch being written)
+    size_t queued_files;
+    size_t queued_bytes;
+    bool stopping;
+};
+
+Writer *
+writer = nullptr;
+
+priv2::stats::Counter
+files_written("Output files written");
+
+priv2::stats::Counter
+bytes_written("Output bytes written");
+
+priv2::stats::Counter
+queue_depth("Output queue depth", priv2::stats::Counter::PEAK);
+
+priv2::stats::Counter
+bytes_in_flight("Output bytes in flight", priv2::stats::Counter::PEAK);
+
+priv2::stats::Counter
+writer_batches("Output writer batches");
+
+priv2::stats::Counter
+writer_stalls("Output writer stalls (queue full)");
+
+priv2::stats::Counter
+writer_syncs("Output writer syncs (journal)");
+
+void
+write_job(priv2::sink::Sink &sink, const Job &job)
+{
+    if (job.source) {
+        sink.copy(job.filename, job.source->fd, job.source_buf - job.source->data(),
+                job.source_buf, job.source_len);
+        bytes_written.add(job.source_len);
+    } else {
+        sink.write(job.filename, job.data.data(), job.data.size());
+        bytes_written.add(job.data.size());
+    }
+
+    files_written.add(1);
+}
+
+void
+Writer::loop()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (true) {
+        cv.wait(lock, [this] () { return !jobs.empty() || stopping; });
+        if (jobs.empty()) {
+            break;
+        }
+
+        // Take everything that has been queued so far and write it in one go
+        std::deque<Job> batch;
+        std::swap(batch, jobs);
+        lock.unlock();
+
+        writer_batches.add(1);
+        std::vector<std::string> records;
+        for (auto &job: batch) {
+            if (!job.record.empty()) {
+                // Written once the files of the whole batch are on disk
+                records.push_back(job.record);
+                continue;
+            }
+
+            write_job(*sink, job);
+
+            size_t size = job.data.size();
+            std::vector<char>().swap(job.data);
+            job.source.reset();
+
+            std::lock_guard<std::mutex> guard(mutex);
+            queued_files--;
+            queued_bytes -= size;
+            queue_depth.add(-1);
+            bytes_in_flight.add(-(int64_t)size);
+            cv.notify_all();
+        }
+
+        if (!records.empty()) {
+            writer_syncs.add(1);
+            sink->sync();
+            priv2::journal::append(records);
+
+            std::lock_guard<std::mutex> guard(mutex);
+            queued_files -= records.size();
+            queue_depth.add(-(int64_t)records.size());
+            cv.notify_all();
+        }
+
+        lock.lock();
+    }
+}
+
+void
+enqueue(Job &&job)
+{
+    if (!writer) {
+        if (!job.record.empty()) {
+            priv2::journal::append(std::vector<std::string>(1, job.record));
+        } else {
+            priv2::sink::DirectorySink sink;
+            write_job(sink, job);
+        }
+        return;
+    }
+
+    // Ranges of input files are not held in memory
+    size_t size = job.data.size();
+
+    std::unique_lock<std::mutex> lock(writer->mutex);
+
+    // Backpressure: wait while the queue is full (unless it is empty,
+    // so that a single file larger than the limit can still be written)
+    auto is_full = [size] () {
+        return writer->queued_files > 0 &&
+            (writer->queued_bytes + size > MAX_QUEUED_BYTES || writer->queued_files >= MAX_QUEUED_FILES);
+    };
+
+    if (is_full()) {
+        writer_stalls.add(1);
+        writer->cv.wait(lock, [&is_full] () { return !is_full(); });
+    }
+
+    writer->jobs.emplace_back(std::move(job));
+    writer->queued_files++;
+    writer->queued_bytes += size;
+    queue_depth.add(1);
+    bytes_in_flight.add(size);
+    writer->cv.notify_all();
+}
+
+}; // end anonymous namespace
+
+namespace priv2 {
+namespace output {
+
+void
+start(priv2::sink::Sink *sink)
+{
+    writer = new Writer(sink);
+    writer->thread = std::thread([] () { writer->loop(); });
+}
+
+void
+submit(const std::string &filename, std::vector<char> &&data)
+{
+    if (auto recorder = priv2::cache::current()) {
+        recorder->add(filename, data);
+    }
+
+    enqueue(Job(filename, std::move(data)));
+}
+
+void
+copy(const std::string &filename, const char *buf, size_t len)
+{
+    auto source = priv2::input::find(buf, len);
+    if (source) {
+        enqueue(Job(filename, source, buf, len));
+    } else {
+        enqueue(Job(filename, std::vector<char>(buf, buf + len)));
+    }
+}
+
+void
+mark(const std::string &record)
+{
+    Job job("", std::vector<char>());
+    job.record = record;
+    enqueue(std::move(job));
+}
+
+void
+drain()
+{
+    if (!writer || std::this_thread::get_id() == writer->thread.get_id()) {
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(writer->mutex);
+    writer->cv.wait(lock, [] () { return writer->queued_files == 0; });
+}
+
+void
+finish()
+{
+    if (!writer) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(writer->mutex);
+        writer->stopping = true;
+    }
+    writer->cv.notify_all();
+    writer->thread.join();
+    writer->sink->close();
+
+    delete writer;
+    writer = nullptr;
+}
+
+};
+};
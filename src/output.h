@@ -0,0 +1,67 @@
+/*
+ * Privateer 2: The Darkening -- Data Dumper
+ * Copyright (c) 2016, 2017, Thomas Perl
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "sink.h"
+
+namespace priv2 {
+namespace output {
+
+/**
+ * Start the background writer, writing into the given sink (which is
+ * owned by the writer from now on). Files submitted afterwards are queued
+ * and written by a separate thread, so decoding does not wait for the
+ * disk. The queue is bounded; submit() blocks while too much data is queued.
+ **/
+void start(priv2::sink::Sink *sink);
+
+/**
+ * Queue a file to be written. Without a running writer, the file is
+ * written to the current directory right away.
+ **/
+void submit(const std::string &filename, std::vector<char> &&data);
+
+/**
+ * Queue a file with a copy of the given data. If the data is a range of a
+ * memory-mapped input file, the sink copies it from the input file's
+ * descriptor (e.g. using a reflink), and no copy is kept in memory.
+ **/
+void copy(const std::string &filename, const char *buf, size_t len);
+
+/**
+ * Queue a journal record. It is written (see priv2::journal) after all
+ * files submitted before it have been written and synced to disk; the
+ * writer does this once per batch, not once per record.
+ **/
+void mark(const std::string &record);
+
+/**
+ * Wait until all queued files have been written.
+ **/
+void drain();
+
+/**
+ * Write all queued files, stop the background writer and close the sink.
+ **/
+void finish();
+
+};
+};
@@ -96,6 +96,8 @@ unsigned char default_pal[] = {
 };
 
 #include "priv2.h"
+#include "pool.h"
+#include "kernel.h"
 
 namespace priv2 {
 namespace gfx {
@@ -120,55 +122,55 @@ Palette::lookup(uint8_t index)
 }
 
 void
+Palette::table(uint32_t colors[256])
+{
+    for (int i=0; i<256; i++) {
+        colors[i] = lookup(i);
+    }
+}
+
+bool
 Palette::raw_from_buffer(const char *buf, size_t len)
 {
     is_raw = true;
 
     if (len != 256 * 3) {
-        priv2::fail("Invalid palette buffer");
+        return priv2::fail("Invalid palette buffer");
     }
 
     memcpy(palette, buf, len);
+    return true;
 }
 
-void
+bool
 Palette::raw_from_file(const std::string &filename)
 {
-    auto paldata = priv2::read_file(filename.c_str());
-    raw_from_buffer(paldata.data(), paldata.size());
+    std::vector<char> paldata;
+    return priv2::read_file(filename.c_str(), paldata) && raw_from_buffer(paldata.data(), paldata.size());
 }
 
 Palette::~Palette()
 {
 }
 
-void save_png(Palette &palette, uint32_t width, uint32_t height,
+bool save_png(Palette &palette, uint32_t width, uint32_t height,
         uint8_t *output, const std::string &filename)
 {
-    std::vector<char> tmp(width*height*4);
-
-    uint32_t *write_ptr = (uint32_t *)tmp.data();
-    uint8_t *read_ptr = output;
-    for (int y=0; y<height; y++) {
-        for (int x=0; x<width; x++) {
-            uint8_t value = *read_ptr++;
-            uint32_t rgba = palette.lookup(value);
-            if (value == 0) {
-                // HACK TO GET TRANSPARENCY WORKING
-                //rgba = 0;
-            }
-            *write_ptr++ = rgba;
-        }
-    }
+    priv2::pool::Buffer tmp(width*height*4);
+    tmp->resize(width*height*4);
+
+    uint32_t colors[256];
+    palette.table(colors);
+    priv2::kernel::expand_palette(colors, output, (uint32_t *)tmp->data(), width * height);
 
-    priv2::write_png(tmp.data(), width, height, "%s", filename.c_str());
+    return priv2::write_png(tmp->data(), width, height, "%s", filename.c_str());
 }
 
-void save_png(uint32_t width, uint32_t height,
+bool save_png(uint32_t width, uint32_t height,
         uint8_t *output, const std::string &filename)
 {
     Palette palette;
-    save_png(palette, width, height, output, filename);
+    return save_png(palette, width, height, output, filename);
 }
 
 };
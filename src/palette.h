@@ -27,19 +27,22 @@ struct Palette {
     Palette();
     ~Palette();
 
-    void raw_from_file(const std::string &filename);
-    void raw_from_buffer(const char *buf, size_t len);
+    bool raw_from_file(const std::string &filename);
+    bool raw_from_buffer(const char *buf, size_t len);
 
     uint32_t lookup(uint8_t index);
 
+    // The lookup() result of each index, for expanding many pixels
+    void table(uint32_t colors[256]);
+
     uint8_t palette[3 * 256];
     bool is_raw;
 };
 
-void save_png(Palette &palette, uint32_t width, uint32_t height,
+bool save_png(Palette &palette, uint32_t width, uint32_t height,
         uint8_t *output, const std::string &filename);
 
-void save_png(uint32_t width, uint32_t height,
+bool save_png(uint32_t width, uint32_t height,
         uint8_t *output, const std::string &filename);
 
 };
@@ -0,0 +1,230 @@
+/*
+ * Privateer 2: The Darkening -- Data Dumper
+ * Copyright (c) 2016, 2017, Thomas Perl
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "path.h"
+#include "pool.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+
+namespace priv2 {
+namespace path {
+
+struct Node {
+    Arena *arena;
+    const Node *flat_parent;
+    const char *flat_name;
+    const Node *tree_parent;
+    const char *tree_name;
+
+    // Parts of the flat name of an IFF chunk (path_sig is nullptr otherwise)
+    const char *path_sig;
+    uint32_t offset;
+    priv2::FourCC form_sig;
+    priv2::FourCC sig;
+};
+
+};
+};
+
+namespace {
+
+priv2::path::Layout
+layout = priv2::path::FLAT;
+
+constexpr size_t BLOCK_SIZE = 64 * 1024;
+
+// For paths that are not part of an input file
+priv2::path::Arena
+default_arena;
+
+const char *
+copy(priv2::path::Arena *arena, const char *str)
+{
+    if (str == nullptr) {
+        return nullptr;
+    }
+
+    size_t len = strlen(str) + 1;
+    return (const char *)memcpy(arena->allocate(len), str, len);
+}
+
+const priv2::path::Node *
+make_node(priv2::path::Arena *arena, const priv2::path::Node *flat_parent, const char *flat_name,
+        const priv2::path::Node *tree_parent, const char *tree_name)
+{
+    auto node = (priv2::path::Node *)arena->allocate(sizeof(priv2::path::Node));
+    node->arena = arena;
+    node->flat_parent = flat_parent;
+    node->flat_name = copy(arena, flat_name);
+    node->tree_parent = tree_parent;
+    // Shared if both names are the same
+    node->tree_name = (tree_name == flat_name) ? node->flat_name : copy(arena, tree_name);
+    node->path_sig = nullptr;
+    return node;
+}
+
+const priv2::path::Node *
+make_chunk_node(priv2::path::Arena *arena, const priv2::path::Node *flat_parent, uint32_t offset,
+        const char *path_sig, priv2::FourCC form_sig, priv2::FourCC sig,
+        const priv2::path::Node *tree_parent, const char *tree_name)
+{
+    auto node = (priv2::path::Node *)make_node(arena, flat_parent, nullptr, tree_parent, tree_name);
+    node->path_sig = copy(arena, path_sig);
+    node->offset = offset;
+    node->form_sig = form_sig;
+    node->sig = sig;
+    return node;
+}
+
+void
+render(std::string &result, const priv2::path::Node *node, bool tree)
+{
+    auto parent = tree ? node->tree_parent : node->flat_parent;
+    auto name = tree ? node->tree_name : node->flat_name;
+
+    if (parent != nullptr) {
+        render(result, parent, tree);
+    }
+
+    if (!tree && node->path_sig != nullptr) {
+        char offset[16];
+        snprintf(offset, sizeof(offset), "%#010x", node->offset);
+
+        if (parent != nullptr) {
+            result += '-';
+        }
+        result.append("chunk-").append(offset).append(1, '-');
+        if (*node->path_sig) {
+            result.append(node->path_sig).append(1, '-');
+        }
+        result.append(node->form_sig.str()).append(1, '-').append(node->sig.str());
+    } else if (name != nullptr) {
+        if (parent != nullptr) {
+            result += tree ? '/' : '-';
+        }
+        result += name;
+    }
+}
+
+}; // end anonymous namespace
+
+namespace priv2 {
+namespace path {
+
+void
+set_layout(Layout value)
+{
+    layout = value;
+}
+
+Layout
+get_layout()
+{
+    return layout;
+}
+
+Arena::Arena()
+    : mutex()
+    , blocks()
+    , pos(nullptr)
+    , left(0)
+{
+}
+
+Arena::~Arena()
+{
+    for (auto &block: blocks) {
+        priv2::pool::give(std::move(block));
+    }
+}
+
+void *
+Arena::allocate(size_t size)
+{
+    size = (size + alignof(void *) - 1) & ~(alignof(void *) - 1);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (left < size) {
+        size_t block_size = std::max(size, BLOCK_SIZE);
+        blocks.emplace_back(priv2::pool::take(block_size));
+        blocks.back().resize(block_size);
+        pos = blocks.back().data();
+        left = block_size;
+    }
+
+    void *result = pos;
+    pos += size;
+    left -= size;
+    return result;
+}
+
+Path::Path(Arena &arena, const std::string &name)
+    : node(make_node(&arena, nullptr, name.c_str(), nullptr, name.c_str()))
+{
+}
+
+Path::Path(const std::string &name)
+    : Path(default_arena, name)
+{
+}
+
+Path::Path(const Path &flat_parent, const char *flat_name, const Path &tree_parent, const char *tree_name)
+    : node(make_node(flat_parent.node->arena, flat_parent.node, flat_name, tree_parent.node, tree_name))
+{
+}
+
+Path::Path(const Path &flat_parent, uint32_t offset, const char *path_sig, priv2::FourCC form_sig,
+        priv2::FourCC sig, const Path &tree_parent, const char *tree_name)
+    : node(make_chunk_node(flat_parent.node->arena, flat_parent.node, offset, path_sig, form_sig, sig,
+                tree_parent.node, tree_name))
+{
+}
+
+Path
+Path::child(const std::string &name) const
+{
+    return Path(*this, name.c_str(), *this, name.c_str());
+}
+
+std::string
+Path::flat() const
+{
+    std::string result;
+    render(result, node, false);
+    return result;
+}
+
+std::string
+Path::tree() const
+{
+    std::string result;
+    render(result, node, true);
+    return result;
+}
+
+std::string
+Path::str() const
+{
+    return (layout == TREE) ? tree() : flat();
+}
+
+};
+};
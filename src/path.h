@@ -0,0 +1,103 @@
+/*
+ * Privateer 2: The Darkening -- Data Dumper
+ * Copyright (c) 2016, 2017, Thomas Perl
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <mutex>
+
+#include "priv2.h"
+
+namespace priv2 {
+namespace path {
+
+enum Layout {
+    // All outputs in the current directory, names joined with '-'
+    FLAT,
+    // Containers (input files, BIG entries, IFF forms) become directories
+    TREE,
+};
+
+void set_layout(Layout layout);
+Layout get_layout();
+
+struct Node;
+
+/**
+ * Memory for the path nodes of one input file, all freed at once when
+ * the arena is destroyed (after the file has been handled). The blocks
+ * come from the buffer pool, and go back to it.
+ **/
+class Arena {
+public:
+    Arena();
+    ~Arena();
+
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    void *allocate(size_t size);
+
+private:
+    std::mutex mutex;
+    std::vector<std::vector<char>> blocks;
+    // Free space in the last block
+    char *pos;
+    size_t left;
+};
+
+/**
+ * Name of a piece of data inside the input files, used as prefix for the
+ * names of its output files. Both names are kept, so that the flat name
+ * (which the text detection rules are written against) is available in
+ * any layout; str() renders the one of the current layout.
+ *
+ * A Path only points to a node with the parent and the last component of
+ * each name, so that nothing is formatted for data that is not written
+ * out. Nodes are allocated from the arena of the root path.
+ **/
+struct Path {
+    // Root path, its arena must outlive all paths below it
+    Path(Arena &arena, const std::string &name);
+
+    // Root path for a single piece of data, never freed
+    explicit Path(const std::string &name);
+
+    // <flat_name> below <flat_parent> and <tree_name> below <tree_parent>,
+    // nullptr for a name that is the same as that of the parent
+    Path(const Path &flat_parent, const char *flat_name, const Path &tree_parent, const char *tree_name);
+
+    // IFF chunk <sig> at <offset> of a <form_sig> form (inside the forms of
+    // <path_sig>), with a flat name like "chunk-0x00000014-ROOM-0008-GRAF"
+    // that is only formatted when the path is rendered
+    Path(const Path &flat_parent, uint32_t offset, const char *path_sig, priv2::FourCC form_sig,
+            priv2::FourCC sig, const Path &tree_parent, const char *tree_name);
+
+    // Element <name> (e.g. a BIG entry) inside this container
+    Path child(const std::string &name) const;
+
+    std::string flat() const;
+    std::string tree() const;
+
+    std::string str() const;
+
+    const Node *node;
+};
+
+};
+};
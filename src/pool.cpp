@@ -0,0 +1,151 @@
+/*
+ * Privateer 2: The Darkening -- Data Dumper
+ * Copyright (c) 2016, 2017, Thomas Perl
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "pool.h"
+#include "stats.h"
+
+#include <algorithm>
+
+namespace {
+
+// Size classes from 4 KiB to 64 MiB, larger buffers are not kept
+constexpr int MIN_SHIFT = 12;
+constexpr int MAX_SHIFT = 26;
+constexpr int CLASSES = MAX_SHIFT - MIN_SHIFT + 1;
+
+// Idle buffers kept per class and thread, and in total per thread
+constexpr size_t MAX_PER_CLASS = 4;
+constexpr size_t MAX_IDLE_BYTES = 64 * 1024 * 1024;
+
+// Share of the thread of the memory limit (read-only once the pools are used)
+size_t
+idle_limit = MAX_IDLE_BYTES;
+
+// Set when the pool of the thread is gone (buffers freed at exit)
+thread_local bool
+destroyed = false;
+
+struct Pool {
+    Pool() : classes(), idle_bytes(0) {}
+    ~Pool() { destroyed = true; }
+
+    std::vector<std::vector<char>> classes[CLASSES];
+    size_t idle_bytes;
+};
+
+thread_local Pool
+local_pool;
+
+priv2::stats::Counter
+buffers_reused("Pool buffers reused");
+
+priv2::stats::Counter
+buffers_allocated("Pool buffers allocated");
+
+// Smallest class that holds <capacity> bytes
+int
+class_for(size_t capacity)
+{
+    int shift = MIN_SHIFT;
+    while (shift <= MAX_SHIFT && ((size_t)1 << shift) < capacity) {
+        shift++;
+    }
+    return shift - MIN_SHIFT;
+}
+
+// Largest class whose size <capacity> is at least
+int
+class_of(size_t capacity)
+{
+    int shift = MIN_SHIFT;
+    while (shift < MAX_SHIFT && ((size_t)1 << (shift + 1)) <= capacity) {
+        shift++;
+    }
+    return shift - MIN_SHIFT;
+}
+
+}; // end anonymous namespace
+
+namespace priv2 {
+namespace pool {
+
+void
+set_limit(size_t bytes, int threads)
+{
+    if (bytes != 0) {
+        idle_limit = std::min(MAX_IDLE_BYTES, bytes / threads);
+    }
+}
+
+size_t
+capacity(size_t capacity)
+{
+    int index = class_for(capacity);
+    if (capacity == 0 || index >= CLASSES) {
+        return capacity;
+    }
+
+    return (size_t)1 << (MIN_SHIFT + index);
+}
+
+std::vector<char>
+take(size_t capacity)
+{
+    std::vector<char> result;
+    if (capacity == 0) {
+        return result;
+    }
+
+    int index = class_for(capacity);
+    if (index >= CLASSES || destroyed) {
+        result.reserve(capacity);
+        return result;
+    }
+
+    auto &idle = local_pool.classes[index];
+    if (!idle.empty()) {
+        result = std::move(idle.back());
+        idle.pop_back();
+        local_pool.idle_bytes -= result.capacity();
+        buffers_reused.add(1);
+        return result;
+    }
+
+    result.reserve((size_t)1 << (MIN_SHIFT + index));
+    buffers_allocated.add(1);
+    return result;
+}
+
+void
+give(std::vector<char> &&buffer)
+{
+    size_t capacity = buffer.capacity();
+    if (destroyed || capacity < ((size_t)1 << MIN_SHIFT) || capacity >= ((size_t)1 << (MAX_SHIFT + 1))) {
+        return;
+    }
+
+    auto &idle = local_pool.classes[class_of(capacity)];
+    if (idle.size() >= MAX_PER_CLASS || local_pool.idle_bytes + capacity > idle_limit) {
+        return;
+    }
+
+    buffer.clear();
+    local_pool.idle_bytes += capacity;
+    idle.emplace_back(std::move(buffer));
+}
+
+};
+};
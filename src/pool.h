@@ -0,0 +1,73 @@
+/*
+ * Privateer 2: The Darkening -- Data Dumper
+ * Copyright (c) 2016, 2017, Thomas Perl
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+#pragma once
+
+#include <vector>
+
+#include <cstddef>
+
+namespace priv2 {
+namespace pool {
+
+/**
+ * Limit the idle buffers kept by the pools of all <threads> threads to
+ * <bytes> in total (--mem-limit), so that they do not add more than that
+ * to the memory of the running tasks. 0 keeps the default limit of each
+ * thread. Call before the pools are used.
+ **/
+void set_limit(size_t bytes, int threads);
+
+/**
+ * Take an empty buffer with a capacity of at least <capacity> bytes from
+ * the calling thread's pool. Buffers are kept in size classes (powers of
+ * two), so memory that has been touched before is used again.
+ **/
+std::vector<char> take(size_t capacity);
+
+/**
+ * Capacity of the buffer that take() returns for <capacity> bytes (the
+ * size of its class), for estimates of the memory used (--mem-limit).
+ **/
+size_t capacity(size_t capacity);
+
+/**
+ * Give a buffer back to the calling thread's pool (any thread's buffers
+ * can be given back). Buffers that are too large, or that do not fit into
+ * the pool anymore, are freed.
+ **/
+void give(std::vector<char> &&buffer);
+
+/**
+ * Scratch buffer of a decoder, taken from the pool and given back when it
+ * goes out of scope. Moving the vector out keeps its memory with the new
+ * owner (e.g. for decompressed chunks that are retained).
+ **/
+struct Buffer {
+    explicit Buffer(size_t capacity=0) : vector(take(capacity)) {}
+    ~Buffer() { give(std::move(vector)); }
+
+    Buffer(const Buffer &) = delete;
+    Buffer &operator=(const Buffer &) = delete;
+
+    std::vector<char> &operator*() { return vector; }
+    std::vector<char> *operator->() { return &vector; }
+
+    std::vector<char> vector;
+};
+
+};
+};
@@ -16,10 +16,22 @@
  */
 
 #include "priv2.h"
+#include "log.h"
+#include "task.h"
+#include "output.h"
+#include "writer.h"
+#include "unit.h"
+#include "kernel.h"
 
 #include <cstdio>
 #include <cstdlib>
 #include <cstdarg>
+#include <cstring>
+
+#include <getopt.h>
+#include <sys/stat.h>
+
+#include <algorithm>
 
 #include <png.h>
 
@@ -41,28 +53,236 @@ basename(const std::string &filename)
     return filename;
 }
 
-void
+bool
 fail(const char *message)
 {
+    // Only the current work unit ends, if there is one
+    if (priv2::unit::abandon(message)) {
+        return false;
+    }
+
+    priv2::log::flush();
+    priv2::output::drain();
     fprintf(stderr, "Fatal error: %s\n", message);
     exit(1);
 }
 
-void
+bool
 fail(const std::string &message)
 {
-    fail(message.c_str());
+    return fail(message.c_str());
+}
+
+static const char *
+VERSION = "1.1 / 2017-04-25";
+
+// Size in bytes, with an optional K, M or G suffix
+static bool
+parse_size(const char *str, size_t &result)
+{
+    char *end;
+    unsigned long long value = strtoull(str, &end, 10);
+    if (end == str) {
+        return false;
+    }
+
+    switch (*end) {
+        case 'G': value <<= 10; // fall through
+        case 'M': value <<= 10; // fall through
+        case 'K': value <<= 10; end++; break;
+        case '\0': break;
+        default: return false;
+    }
+
+    result = value;
+    return (*end == '\0');
 }
 
 CLI::CLI(int argc, char **argv)
     : argc(argc)
     , argv(argv)
+    , command()
+    , raw(false)
+    , filenames()
+    , jobs(1)
+    , mem_limit(0)
+    , verbosity(priv2::log::INFO)
+    , shard_index(1)
+    , shard_count(1)
+    , stats(false)
+    , tar()
+    , tree_layout(false)
+    , cache()
+    , resume(false)
+    , cpu_level(-1)
+    , version(false)
+    , includes()
+    , excludes()
 {
-    printf(
+    enum {
+        OPTION_SHARD = 0x100,
+        OPTION_STATS,
+        OPTION_TAR,
+        OPTION_LAYOUT,
+        OPTION_CACHE,
+        OPTION_RESUME,
+        OPTION_INCLUDE,
+        OPTION_EXCLUDE,
+        OPTION_RAW,
+        OPTION_MEM_LIMIT,
+        OPTION_CPU,
+        OPTION_VERSION,
+    };
+
+    static const struct option long_options[] = {
+        {"shard", required_argument, nullptr, OPTION_SHARD},
+        {"stats", no_argument, nullptr, OPTION_STATS},
+        {"tar", required_argument, nullptr, OPTION_TAR},
+        {"layout", required_argument, nullptr, OPTION_LAYOUT},
+        {"cache", required_argument, nullptr, OPTION_CACHE},
+        {"resume", no_argument, nullptr, OPTION_RESUME},
+        {"include", required_argument, nullptr, OPTION_INCLUDE},
+        {"exclude", required_argument, nullptr, OPTION_EXCLUDE},
+        {"raw", no_argument, nullptr, OPTION_RAW},
+        {"mem-limit", required_argument, nullptr, OPTION_MEM_LIMIT},
+        {"cpu", required_argument, nullptr, OPTION_CPU},
+        {"version", no_argument, nullptr, OPTION_VERSION},
+        {nullptr, 0, nullptr, 0},
+    };
+
+    // Subcommands come first, their options after them
+    int first = 0;
+    if (argc > 1 && (strcmp(argv[1], "cat") == 0 || strcmp(argv[1], "list") == 0)) {
+        command = argv[1];
+        first = 1;
+    }
+
+    int opt;
+    while ((opt = getopt_long(argc - first, argv + first, "j:qv", long_options, nullptr)) != -1) {
+        switch (opt) {
+            case 'j':
+                jobs = atoi(optarg);
+                if (jobs < 1) {
+                    priv2::fail("Number of jobs must be at least 1");
+                }
+                break;
+            case 'q':
+                verbosity = priv2::log::QUIET;
+                break;
+            case 'v':
+                verbosity = std::min<int>(verbosity + 1, priv2::log::DEBUG);
+                break;
+            case OPTION_SHARD:
+                if (sscanf(optarg, "%d/%d", &shard_index, &shard_count) != 2 ||
+                        shard_count < 1 || shard_index < 1 || shard_index > shard_count) {
+                    priv2::fail("Invalid shard, expected I/N with 1 <= I <= N");
+                }
+                break;
+            case OPTION_STATS:
+                stats = true;
+                break;
+            case OPTION_TAR:
+                tar = optarg;
+                break;
+            case OPTION_LAYOUT:
+                if (strcmp(optarg, "tree") == 0) {
+                    tree_layout = true;
+                } else if (strcmp(optarg, "flat") == 0) {
+                    tree_layout = false;
+                } else {
+                    priv2::fail("Invalid layout, expected flat or tree");
+                }
+                break;
+            case OPTION_CACHE:
+                cache = optarg;
+                break;
+            case OPTION_RESUME:
+                resume = true;
+                break;
+            case OPTION_INCLUDE:
+                includes.emplace_back(optarg);
+                break;
+            case OPTION_EXCLUDE:
+                excludes.emplace_back(optarg);
+                break;
+            case OPTION_RAW:
+                raw = true;
+                break;
+            case OPTION_MEM_LIMIT:
+                if (!parse_size(optarg, mem_limit)) {
+                    priv2::fail("Invalid memory limit, expected a size like 512M or 4G");
+                }
+                break;
+            case OPTION_CPU:
+                {
+                    priv2::kernel::Level level;
+                    if (!priv2::kernel::parse(optarg, level)) {
+                        priv2::fail("Invalid CPU kernels, expected scalar, sse4.2 or avx2");
+                    }
+                    cpu_level = level;
+                }
+                break;
+            case OPTION_VERSION:
+                version = true;
+                break;
+            default:
+                priv2::fail("Invalid command line option");
+        }
+    }
+
+    filenames.assign(argv + first + optind, argv + argc);
+
+    if (resume && !tar.empty()) {
+        priv2::fail("--resume can not be used with --tar");
+    }
+
+    auto detected = priv2::kernel::detect();
+    if (cpu_level == -1) {
+        cpu_level = detected;
+    } else if (cpu_level > detected) {
+        priv2::fail(priv2::format("This CPU does not support the %s kernels",
+                    priv2::kernel::name((priv2::kernel::Level)cpu_level)));
+    }
+    priv2::kernel::select((priv2::kernel::Level)cpu_level);
+
+    if (version) {
+        printf("Privateer 2: The Darkening -- Data Dumper\n"
+               "Ver %s Thomas Perl <thp.io>\n"
+               "Kernels: %s (detected: %s)\n", VERSION,
+               priv2::kernel::name(priv2::kernel::selected()), priv2::kernel::name(detected));
+        exit(0);
+    }
+
+    if (tar == "-" || !command.empty()) {
+        // stdout carries the archive, keep the console output out of it
+        priv2::log::redirect(stderr);
+    }
+
+    priv2::log::set_level((priv2::log::Level)verbosity);
+
+    priv2::log::info(
         "Privateer 2: The Darkening -- Data Dumper\n"
         "-----------------------------------------\n"
-        "Ver 1.1 / 2017-04-25 Thomas Perl <thp.io>\n\n"
-        "Usage: %s <filename> [...]\n"
+        "Ver %s Thomas Perl <thp.io>\n\n"
+        "Usage: %s [options] <filename> [...]\n"
+        "       %s cat [--raw] [options] <file> <path>\n"
+        "       %s list <filename> [...]\n"
+        "\n"
+        "Options:\n"
+        " -j N ...................................... Use N worker threads\n"
+        " --mem-limit SIZE .......................... Memory for running tasks (e.g. 2G)\n"
+        " -q, -v, -vv ............................... Less, more or debug console output\n"
+        " --shard I/N ............................... Only extract shard I of N\n"
+        " --stats ................................... Print statistics at the end\n"
+        " --tar FILE ................................ Write outputs to tar FILE (- for stdout)\n"
+        " --layout flat|tree ........................ Output file layout (default: flat)\n"
+        " --cache DIR ............................... Reuse decoded outputs cached in DIR\n"
+        " --resume .................................. Skip work finished by an earlier run\n"
+        " --include PATTERN ......................... Only extract paths matching PATTERN\n"
+        " --exclude PATTERN ......................... Skip paths matching PATTERN\n"
+        " --raw ..................................... cat: Write the entry as stored\n"
+        " --cpu scalar|sse4.2|avx2 .................. Byte loop kernels (default: best)\n"
+        " --version ................................. Show version and kernels used\n"
         "\n"
         "Supported container formats:\n"
         " - BIGF\n"
@@ -82,39 +302,65 @@ CLI::CLI(int argc, char **argv)
         " - BRender 3D Model (BR3D) ................. OBJ/MTL\n"
         " - Indexed String list ..................... TXT\n"
         " - Movie List .............................. TXT\n"
-        "\n", basename(argv[0]).c_str());
+        "\n", VERSION, basename(argv[0]).c_str(), basename(argv[0]).c_str(), basename(argv[0]).c_str());
+
+    priv2::log::verbose("Using the %s kernels\n", priv2::kernel::name(priv2::kernel::selected()));
 }
 
 void
 CLI::for_each(std::function<void(const std::string &, const std::string &)> handler)
 {
-    if (argc == 1) {
+    if (filenames.empty()) {
         priv2::fail("Need at least 1 filename as argument");
     }
 
-    for (int i=1; i<argc; i++) {
-        std::string filename = argv[i];
-        std::string basename = priv2::basename(filename);
+    if (jobs == 1) {
+        for (auto &filename: filenames) {
+            handler(filename, priv2::basename(filename));
+        }
+
+        return;
+    }
+
+    // Start with the largest files, so that a single big file
+    // does not end up being processed alone at the end of the run
+    std::vector<std::pair<off_t, std::string>> queue;
+    for (auto &filename: filenames) {
+        struct stat st;
+        queue.emplace_back((stat(filename.c_str(), &st) == 0) ? st.st_size : 0, filename);
+    }
 
-        handler(filename, basename);
+    std::stable_sort(queue.begin(), queue.end(), [] (const std::pair<off_t, std::string> &a,
+                                                     const std::pair<off_t, std::string> &b) {
+        return a.first > b.first;
+    });
+
+    priv2::task::Group group;
+    for (auto &item: queue) {
+        auto &filename = item.second;
+        group.spawn([&handler, &filename] () {
+            priv2::log::Group log_group;
+            handler(filename, priv2::basename(filename));
+        });
     }
+    group.wait();
 }
 
-std::vector<char>
-read_file(const std::string &filename)
+bool
+read_file(const std::string &filename, std::vector<char> &result)
 {
     FILE *fp = fopen(filename.c_str(), "rb");
-    if (!fp) fail("Could not open file");
+    if (!fp) return fail("Could not open file");
 
     fseek(fp, 0, SEEK_END);
     size_t len = ftell(fp);
     fseek(fp, 0, SEEK_SET);
 
-    std::vector<char> result(len);
+    result.resize(len);
     fread(result.data(), result.size(), 1, fp);
     fclose(fp);
 
-    return result;
+    return true;
 }
 
 void
@@ -123,13 +369,7 @@ vwrite_file(const char *buf, size_t len, const char *fmt, va_list ap)
     char *filename;
     vasprintf(&filename, fmt, ap);
 
-    FILE *fp = fopen(filename, "wb");
-    if (!fp) {
-        priv2::fail(priv2::format("Could not open file for writing: %s", filename));
-    }
-
-    fwrite(buf, len, 1, fp);
-    fclose(fp);
+    priv2::output::submit(filename, std::vector<char>(buf, buf + len));
     free(filename);
 }
 
@@ -154,16 +394,16 @@ write_file(const std::string &str, const char *fmt, ...)
 void
 write_file(const std::vector<std::string> &lines, const char *fmt, ...)
 {
-    std::string tmp;
+    priv2::writer::Writer tmp;
     int i = 0;
     for (auto &line: lines) {
-        tmp += format("== Item #%d (0x%08x) ==\n%s\n\n", i, i, line.c_str());
+        tmp.str("== Item #").dec(i).str(" (0x").hex(i, 8).str(") ==\n").str(line).str("\n\n");
         i++;
     }
 
     va_list ap;
     va_start(ap, fmt);
-    vwrite_file(tmp.data(), tmp.size(), fmt, ap);
+    tmp.vwrite_file(fmt, ap);
     va_end(ap);
 }
 
@@ -181,44 +421,62 @@ format(const char *fmt, ...)
     return result;
 }
 
-void
-write_png(char *rgba_pixels, int width, int height, const char *fmt, ...)
+// libpng longjmps here on errors, so everything with a destructor is
+// owned by the caller
+static bool
+encode_png(png_structp png, png_infop info, int width, int height, png_bytep *row_pointers,
+        std::vector<char> *encoded)
 {
-    va_list ap;
-    va_start(ap, fmt);
-    char *filename;
-    vasprintf(&filename, fmt, ap);
-    va_end(ap);
-
-    png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-    png_infop info = png_create_info_struct(png);
-
     if (setjmp(png_jmpbuf(png))) {
-        priv2::fail("libPNG write error");
+        return false;
     }
 
-    FILE *fp = fopen(filename, "wb");
-    if (!fp) {
-        priv2::fail("Could not open file for writing");
-    }
-    png_init_io(png, fp);
+    png_set_write_fn(png, encoded, [] (png_structp png, png_bytep data, png_size_t length) {
+        auto encoded = (std::vector<char> *)png_get_io_ptr(png);
+        encoded->insert(encoded->end(), (char *)data, (char *)data + length);
+    }, nullptr);
     png_set_IHDR(png, info, width, height, 8, PNG_COLOR_TYPE_RGBA, PNG_INTERLACE_NONE,
             PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
     png_write_info(png, info);
+    png_write_image(png, row_pointers);
+    png_write_end(png, NULL);
+
+    return true;
+}
+
+bool
+write_png(char *rgba_pixels, int width, int height, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    char *filename;
+    vasprintf(&filename, fmt, ap);
+    va_end(ap);
 
     std::vector<png_bytep> row_pointers(height);
     for (int i=0; i<height; i++) {
         row_pointers[i] = (png_bytep)(rgba_pixels + width * 4 * i);
     }
 
-    png_write_image(png, row_pointers.data());
-    png_write_end(png, NULL);
+    // Encode to memory, the file is written by the output writer
+    std::vector<char> encoded;
 
+    png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    png_infop info = png_create_info_struct(png);
+    bool ok = encode_png(png, info, width, height, row_pointers.data(), &encoded);
     png_destroy_write_struct(&png, &info);
 
-    fclose(fp);
+    if (ok) {
+        priv2::output::submit(filename, std::move(encoded));
+    }
 
     free(filename);
+
+    if (!ok) {
+        return priv2::fail("libPNG write error");
+    }
+
+    return true;
 }
 
 };
@@ -21,6 +21,9 @@
 #include <string>
 #include <functional>
 
+#include <cstdint>
+#include <cstddef>
+
 namespace priv2 {
 
 inline uint32_t byteswap(uint32_t value)
@@ -40,23 +43,95 @@ struct CLI {
 
     int argc;
     char **argv;
+
+    // Subcommand: empty (extract everything), "cat" or "list"
+    std::string command;
+
+    // Write the entry as it is in the archive (cat --raw)
+    bool raw;
+
+    // Input files (non-option arguments)
+    std::vector<std::string> filenames;
+
+    // Number of worker threads (-j)
+    int jobs;
+
+    // Memory that running tasks may reserve in bytes, 0 for no limit (--mem-limit)
+    size_t mem_limit;
+
+    // Console output level: 0 = quiet (-q), 1 = default, 2 = verbose (-v), 3 = debug (-vv)
+    int verbosity;
+
+    // Process only the work units of shard <shard_index> of <shard_count> (--shard, 1-based)
+    int shard_index;
+    int shard_count;
+
+    // Print statistics at the end of the run (--stats)
+    bool stats;
+
+    // Write all outputs into this tar archive, "-" for stdout (--tar)
+    std::string tar;
+
+    // Create a directory for each container (--layout tree)
+    bool tree_layout;
+
+    // Directory of the decode cache, empty if disabled (--cache)
+    std::string cache;
+
+    // Keep a journal of finished units, skip those of earlier runs (--resume)
+    bool resume;
+
+    // Instruction set of the byte loops, -1 to use the best one (--cpu)
+    int cpu_level;
+
+    // Print the version and the kernels used, then exit (--version)
+    bool version;
+
+    // Logical path patterns of the data to extract (--include) or skip (--exclude)
+    std::vector<std::string> includes;
+    std::vector<std::string> excludes;
 };
 
-static inline std::string
-fourcc(uint32_t value)
+/**
+ * Four-character code, as stored in the file, compared as an integer.
+ * Literals are written as "FORM"_cc; str() is for logs and filenames.
+ **/
+struct FourCC {
+    constexpr FourCC() : value(0) {}
+    constexpr explicit FourCC(uint32_t value) : value(value) {}
+
+    constexpr bool operator==(FourCC other) const { return value == other.value; }
+    constexpr bool operator!=(FourCC other) const { return value != other.value; }
+
+    std::string str() const { return std::string((const char *)&value, 4); }
+
+    uint32_t value;
+};
+
+// Not defined, so that literals of the wrong length do not link
+FourCC invalid_fourcc_literal();
+
+constexpr FourCC
+operator"" _cc(const char *s, size_t len)
 {
-    return std::string((char *)&value, 4);
+    return (len == 4) ? FourCC((uint32_t)(uint8_t)s[0] | (uint32_t)(uint8_t)s[1] << 8 |
+            (uint32_t)(uint8_t)s[2] << 16 | (uint32_t)(uint8_t)s[3] << 24) : invalid_fourcc_literal();
 }
 
-void fail(const char *message);
-void fail(const std::string &message);
+/**
+ * Fail the work unit running on the calling thread and return false, so
+ * that decoders can pass the failure up with "return priv2::fail(...)".
+ * If no unit is running, print the message and exit.
+ **/
+bool fail(const char *message);
+bool fail(const std::string &message);
 
-std::vector<char> read_file(const std::string &filename);
+bool read_file(const std::string &filename, std::vector<char> &result);
 void vwrite_file(const char *buf, size_t len, const char *fmt, va_list ap);
 void write_file(const char *buf, size_t len, const char *fmt, ...);
 void write_file(const std::string &str, const char *fmt, ...);
 void write_file(const std::vector<std::string> &lines, const char *fmt, ...);
-void write_png(char *rgba_pixels, int width, int height, const char *fmt, ...);
+bool write_png(char *rgba_pixels, int width, int height, const char *fmt, ...);
 std::string format(const char *fmt, ...);
 
 };
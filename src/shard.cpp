@@ -0,0 +1,199 @@
+/*
+ * Privateer 2: The Darkening -- Data Dumper
+ * Copyright (c) 2016, 2017, Thomas Perl
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "shard.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <map>
+#include <algorithm>
+
+#include "priv2.h"
+#include "log.h"
+#include "big.h"
+
+namespace {
+
+using priv2::operator"" _cc;
+
+struct Unit {
+    Unit(const std::string &filename, uint32_t offset, uint64_t size)
+        : filename(filename)
+        , offset(offset)
+        , size(size)
+    {
+    }
+
+    std::string filename;
+    uint32_t offset;
+    uint64_t size;
+};
+
+// Units of this shard (true) and of other shards (false)
+std::map<std::pair<std::string, uint32_t>, bool>
+units;
+
+bool
+read_at(FILE *fp, long offset, void *buf, size_t len)
+{
+    return (fseek(fp, offset, SEEK_SET) == 0 && fread(buf, len, 1, fp) == 1);
+}
+
+void
+find_big_units(const std::string &filename, const std::string &basename, std::vector<Unit> &result)
+{
+    auto index = priv2::big::open(filename);
+    if (!index) {
+        return;
+    }
+
+    for (auto &entry: index->entries) {
+        result.emplace_back(basename, entry.offset, entry.length);
+    }
+}
+
+void
+find_iff_units(FILE *fp, const std::string &basename, uint64_t len, std::vector<Unit> &result)
+{
+    constexpr uint32_t HEADER_SIZE = sizeof(uint32_t) * 2;
+
+    uint32_t header[3];
+    if (len < sizeof(header) || !read_at(fp, 0, header, sizeof(header))) {
+        return;
+    }
+
+    // Same clamping of the root FORM length as in IFF::parse()
+    uint64_t local_len = std::min<uint64_t>(priv2::byteswap(header[1]), len - HEADER_SIZE);
+    priv2::FourCC form_sig(header[2]);
+
+    if (form_sig == "BR3D"_cc || form_sig == "BRPM"_cc) {
+        // Complete-form handlers need all children, keep them together
+        result.emplace_back(basename, 0, len);
+        return;
+    }
+
+    // Offsets of children as reported by IFF::handle_form() (start of payload)
+    uint64_t pos = HEADER_SIZE + sizeof(uint32_t);
+    uint64_t end = HEADER_SIZE + local_len;
+    while (pos + HEADER_SIZE <= end) {
+        uint32_t chunk_header[2];
+        if (!read_at(fp, pos, chunk_header, sizeof(chunk_header))) {
+            break;
+        }
+
+        uint32_t chunk_len = priv2::byteswap(chunk_header[1]);
+        if (chunk_len == 0) {
+            // Let the parser complain about it
+            break;
+        }
+
+        result.emplace_back(basename, pos + HEADER_SIZE, HEADER_SIZE + chunk_len);
+        pos += HEADER_SIZE + chunk_len + (chunk_len % 2);
+    }
+
+    if (end < len) {
+        // Trailing data after the root FORM
+        result.emplace_back(basename, end, len - end);
+    }
+}
+
+}; // end anonymous namespace
+
+namespace priv2 {
+namespace shard {
+
+void
+plan(const std::vector<std::string> &filenames, int index, int count)
+{
+    std::vector<Unit> all;
+
+    for (auto &filename: filenames) {
+        auto basename = priv2::basename(filename);
+
+        FILE *fp = fopen(filename.c_str(), "rb");
+        if (!fp) {
+            priv2::fail(priv2::format("Could not open file: %s", filename.c_str()));
+        }
+
+        fseek(fp, 0, SEEK_END);
+        uint64_t len = ftell(fp);
+
+        uint32_t sig = 0;
+        std::vector<Unit> found;
+        if (read_at(fp, 0, &sig, sizeof(sig))) {
+            if (priv2::FourCC(sig) == "BIGF"_cc) {
+                find_big_units(filename, basename, found);
+            } else if (priv2::FourCC(sig) == "FORM"_cc) {
+                find_iff_units(fp, basename, len, found);
+            }
+        }
+
+        fclose(fp);
+
+        if (found.empty()) {
+            // Not a container (or nothing in it), the whole file is one unit
+            found.emplace_back(basename, 0, len);
+        }
+
+        all.insert(all.end(), found.begin(), found.end());
+    }
+
+    // Largest units first, each to the shard with the least data so far;
+    // the order only depends on the units, so every shard gets the same plan
+    std::sort(all.begin(), all.end(), [] (const Unit &a, const Unit &b) {
+        if (a.size != b.size) {
+            return a.size > b.size;
+        }
+        if (a.filename != b.filename) {
+            return a.filename < b.filename;
+        }
+        return a.offset < b.offset;
+    });
+
+    std::vector<uint64_t> load(count);
+    size_t own_units = 0;
+    for (auto &unit: all) {
+        int shard = std::min_element(load.begin(), load.end()) - load.begin();
+        load[shard] += unit.size;
+
+        bool own = (shard == index - 1);
+        units[std::make_pair(unit.filename, unit.offset)] = own;
+        if (own) {
+            own_units++;
+        }
+    }
+
+    uint64_t total = 0;
+    for (auto &l: load) {
+        total += l;
+    }
+
+    priv2::log::info("Shard %d/%d: %d of %d work units, %llu of %llu bytes\n", index, count,
+            (int)own_units, (int)all.size(), (unsigned long long)load[index - 1], (unsigned long long)total);
+}
+
+bool
+owns(const std::string &filename, uint32_t offset)
+{
+    auto it = units.find(std::make_pair(filename, offset));
+    return (it == units.end() || it->second);
+}
+
+};
+};
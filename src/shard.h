@@ -0,0 +1,49 @@
+/*
+ * Privateer 2: The Darkening -- Data Dumper
+ * Copyright (c) 2016, 2017, Thomas Perl
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <string>
+
+namespace priv2 {
+namespace shard {
+
+/**
+ * Split the work of a run over the given files into <count> shards and
+ * remember which work units belong to shard <index> (1-based).
+ *
+ * Work units are the top-level files themselves, the entries of top-level
+ * BIG files, and the children of the root FORM of top-level IFF files.
+ * Only the BIG directory and the IFF chunk headers are read to find them,
+ * and they are distributed by size, so all shards end up with about the
+ * same amount of data to decode.
+ **/
+void plan(const std::vector<std::string> &filenames, int index, int count);
+
+/**
+ * Check if the work unit at <offset> in the top-level file <filename>
+ * (the basename, as used as filename prefix) belongs to this shard.
+ * Only ask this for work units: offsets of nested chunks may point into
+ * decompressed data and collide with those of units; nested chunks go
+ * with the unit they are in. Unknown offsets are always owned.
+ **/
+bool owns(const std::string &filename, uint32_t offset);
+
+};
+};
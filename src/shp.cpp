@@ -26,9 +26,13 @@
 #include <string>
 
 #include "priv2.h"
+#include "log.h"
 #include "palette.h"
+#include "task.h"
+#include "pool.h"
 
 #include "shp.h"
+#include "handler.h"
 
 namespace {
 
@@ -88,14 +92,14 @@ bool
 is_image(const char *buf, size_t len)
 {
     uint32_t *read_ptr = (uint32_t *)buf;
-    return (len >= 4 && priv2::fourcc(*read_ptr++) == "1.40");
+    return (len >= 4 && priv2::FourCC(*read_ptr++) == "1.40"_cc);
 }
 
-void
-decode_image(const char *buf, size_t len, const std::string &filename_prefix)
+bool
+decode_image(const char *buf, size_t len, const priv2::path::Path &filename_prefix)
 {
     if (!is_image(buf, len)) {
-        priv2::fail("Not a SHP image");
+        return priv2::fail("Not a SHP image");
     }
 
     priv2::gfx::Palette palette;
@@ -107,14 +111,14 @@ decode_image(const char *buf, size_t len, const std::string &filename_prefix)
     read_ptr++;
 
     uint32_t number_of_items = *read_ptr++;
-    printf("File size: %d, number of images in file: %d\n", (int)len, number_of_items);
+    priv2::log::verbose("File size: %d, number of images in file: %d\n", (int)len, number_of_items);
 
     std::vector<SubImage> images;
     for (int i=0; i<number_of_items; i++) {
         uint32_t offset = *read_ptr++;
         uint32_t zero = *read_ptr++;
         if (zero != 0) {
-            priv2::fail("Expected zero here");
+            return priv2::fail("Expected zero here");
         }
 
         if (images.size()) {
@@ -127,17 +131,24 @@ decode_image(const char *buf, size_t len, const std::string &filename_prefix)
 
     images.back().size = len - images.back().offset;
 
+    // Rendered once for the names of all images
+    auto prefix = filename_prefix.str();
+
     int i = 0;
     for (auto &image: images) {
         if (image.is_palette()) {
-            printf("Palette @ index %d, offset 0x%08x (%d bytes)\n", i, image.offset, image.size);
+            priv2::log::verbose("Palette @ index %d, offset 0x%08x (%d bytes)\n", i, image.offset, image.size);
             priv2::write_file(buf + image.offset, image.size, "%s-palette-0x%08x.pal",
-                    filename_prefix.c_str(), image.offset);
-            palette.raw_from_buffer(buf + image.offset, image.size);
+                    prefix.c_str(), image.offset);
+            if (!palette.raw_from_buffer(buf + image.offset, image.size)) {
+                return false;
+            }
         }
         i++;
     }
 
+    priv2::task::Group group;
+
     i = 0;
     for (auto &image: images) {
         if (image.is_palette()) {
@@ -158,28 +169,42 @@ decode_image(const char *buf, size_t len, const std::string &filename_prefix)
         size_t buffer_size = width * height;
 
         // save bmp
-        auto filename = priv2::format("%s-%d.png", filename_prefix.c_str(), i);
+        auto filename = priv2::format("%s-%d.png", prefix.c_str(), i);
 
-        printf("Image %d: %dx%d size=%d, (displacement x=%d, y=%d) -> %s\n", i,
+        priv2::log::info("Image %d: %dx%d size=%d, (displacement x=%d, y=%d) -> %s\n", i,
                 width, height, image.size,
                 displacementX, displacementY, filename.c_str());
 
         if (displacementX > 1024 || displacementY > 1024) {
             // Image 60: 3x3 size=24, (displacement x=2147483647, y=2147483335) -> SETS.IFF-BEX.IFF-chunk-0x001a08a8-ROOM-0018-OBJS-SHAP-GRAF.bin-60.png
-            printf("NEED TO LOOK INTO THIS, SKIPPING\n");
+            priv2::log::warning("NEED TO LOOK INTO THIS, SKIPPING\n");
             continue;
         }
 
-        std::vector<uint8_t> output(buffer_size);
+        // Peak memory (--mem-limit): the pool buffers of the indexed pixels, and
+        // of the RGBA pixels of the PNG
+        size_t memory = priv2::pool::capacity(buffer_size) + priv2::pool::capacity(buffer_size * 4);
+        group.spawn([&palette, local_ptr, width, height, buffer_size, filename] () {
+            // Zero-filled, pixels can be skipped
+            priv2::pool::Buffer output(buffer_size);
+            output->resize(buffer_size);
 
-        // unpack data
-        unpack_image((uint8_t *)local_ptr, output.data(), width, height);
+            // unpack data
+            unpack_image((uint8_t *)local_ptr, (uint8_t *)output->data(), width, height);
 
-        priv2::gfx::save_png(palette, width, height, output.data(), filename);
+            priv2::gfx::save_png(palette, width, height, (uint8_t *)output->data(), filename);
+        }, memory);
 
         i++;
     }
+
+    // Failures of the images are recorded for the unit
+    group.wait();
+    return true;
 }
 
+static priv2::handler::Format
+image_format("shp", "Handled as SHP image", priv2::handler::Format::DATA, "1.40"_cc, is_image, decode_image);
+
 };
 };
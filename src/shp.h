@@ -19,14 +19,16 @@
 
 #include <string>
 
+#include "path.h"
+
 namespace priv2 {
 namespace shp {
 
 bool
 is_image(const char *buf, size_t len);
 
-void
-decode_image(const char *buf, size_t len, const std::string &filename_prefix);
+bool
+decode_image(const char *buf, size_t len, const priv2::path::Path &filename_prefix);
 
 };
 };
@@ -0,0 +1,320 @@
+/*
+ * Privateer 2: The Darkening -- Data Dumper
+ * Copyright (c) 2016, 2017, Thomas Perl
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "sink.h"
+
+#include <string.h>
+#include <errno.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+
+#include <algorithm>
+
+#include "priv2.h"
+#include "stats.h"
+
+namespace {
+
+constexpr size_t TAR_BLOCK_SIZE = 512;
+
+struct TarHeader {
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char checksum[8];
+    char type;
+    char linkname[100];
+    char magic[6];
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];
+    char padding[12];
+};
+
+static_assert(sizeof(TarHeader) == TAR_BLOCK_SIZE, "Unexpected tar header size");
+
+priv2::stats::Counter
+bytes_cloned("Raw copy bytes cloned (reflink)");
+
+priv2::stats::Counter
+bytes_copied_in_kernel("Raw copy bytes copied (copy_file_range)");
+
+priv2::stats::Counter
+bytes_copied_from_memory("Raw copy bytes written from memory");
+
+}; // end anonymous namespace
+
+namespace priv2 {
+namespace sink {
+
+DirectorySink::DirectorySink(bool atomic)
+    : atomic(atomic)
+{
+}
+
+void
+DirectorySink::make_parents(const std::string &filename)
+{
+    size_t pos = filename.rfind('/');
+    if (pos == std::string::npos || pos == 0) {
+        return;
+    }
+
+    std::string directory = filename.substr(0, pos);
+    if (directories.count(directory)) {
+        return;
+    }
+
+    make_parents(directory);
+
+    if (mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST) {
+        priv2::fail(priv2::format("Could not create directory: %s", directory.c_str()));
+    }
+
+    directories.insert(directory);
+}
+
+void
+DirectorySink::write(const std::string &filename, const char *buf, size_t len)
+{
+    make_parents(filename);
+
+    std::string tmp_filename = part_filename(filename);
+    FILE *fp = fopen(tmp_filename.c_str(), "wb");
+    if (!fp) {
+        priv2::fail(priv2::format("Could not open file for writing: %s", filename.c_str()));
+    }
+
+    // The partial file is left behind on errors
+    if (len > 0 && fwrite(buf, len, 1, fp) != 1) {
+        fclose(fp);
+        priv2::fail(priv2::format("Could not write file: %s", filename.c_str()));
+    }
+
+    if (fclose(fp) != 0) {
+        priv2::fail(priv2::format("Could not write file: %s", filename.c_str()));
+    }
+
+    commit(tmp_filename, filename);
+}
+
+std::string
+DirectorySink::part_filename(const std::string &filename)
+{
+    return atomic ? filename + ".part" : filename;
+}
+
+void
+DirectorySink::commit(const std::string &tmp_filename, const std::string &filename)
+{
+    if (atomic && rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+        priv2::fail(priv2::format("Could not rename file: %s", filename.c_str()));
+    }
+}
+
+void
+DirectorySink::sync()
+{
+#ifdef __linux__
+    // One call for all files written since the last sync
+    int fd = ::open(".", O_RDONLY | O_DIRECTORY);
+    if (fd != -1) {
+        syncfs(fd);
+        ::close(fd);
+        return;
+    }
+#endif
+
+    ::sync();
+}
+
+void
+DirectorySink::copy(const std::string &filename, int fd, off_t offset, const char *buf, size_t len)
+{
+    make_parents(filename);
+
+    std::string tmp_filename = part_filename(filename);
+    int out = ::open(tmp_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out == -1) {
+        priv2::fail(priv2::format("Could not open file for writing: %s", filename.c_str()));
+    }
+
+    size_t done = 0;
+
+#ifdef __linux__
+    // Share the extents with the input file (btrfs, xfs); this only works
+    // if the range is aligned to the file system block size
+    struct file_clone_range range;
+    range.src_fd = fd;
+    range.src_offset = offset;
+    range.src_length = len;
+    range.dest_offset = 0;
+    if (len > 0 && ioctl(out, FICLONERANGE, &range) == 0) {
+        bytes_cloned.add(len);
+        done = len;
+    }
+
+    // Copy in the kernel, without going through user space
+    while (done < len) {
+        loff_t in_offset = offset + done;
+        ssize_t count = copy_file_range(fd, &in_offset, out, nullptr, len - done, 0);
+        if (count <= 0) {
+            break;
+        }
+
+        bytes_copied_in_kernel.add(count);
+        done += count;
+    }
+#endif
+
+    // Fallback: write out the remainder from the mapped input
+    while (done < len) {
+        ssize_t count = ::write(out, buf + done, len - done);
+        if (count <= 0) {
+            priv2::fail(priv2::format("Could not write file: %s", filename.c_str()));
+        }
+
+        bytes_copied_from_memory.add(count);
+        done += count;
+    }
+
+    if (::close(out) != 0) {
+        priv2::fail(priv2::format("Could not write file: %s", filename.c_str()));
+    }
+
+    commit(tmp_filename, filename);
+}
+
+TarSink::TarSink(const std::string &filename)
+    : fp(nullptr)
+    , mtime(time(nullptr))
+{
+    if (filename == "-") {
+        fp = stdout;
+    } else {
+        fp = fopen(filename.c_str(), "wb");
+        if (!fp) {
+            priv2::fail(priv2::format("Could not open file for writing: %s", filename.c_str()));
+        }
+    }
+}
+
+TarSink::~TarSink()
+{
+    close();
+}
+
+void
+TarSink::write_padded(const char *buf, size_t len)
+{
+    static const char zeros[TAR_BLOCK_SIZE] = {};
+
+    if ((len > 0 && fwrite(buf, len, 1, fp) != 1) ||
+            (len % TAR_BLOCK_SIZE && fwrite(zeros, TAR_BLOCK_SIZE - len % TAR_BLOCK_SIZE, 1, fp) != 1)) {
+        priv2::fail("Could not write tar archive");
+    }
+}
+
+void
+TarSink::write_header(const std::string &filename, size_t len, char type)
+{
+    TarHeader header;
+    memset(&header, 0, sizeof(header));
+
+    memcpy(header.name, filename.data(), std::min(filename.size(), sizeof(header.name)));
+    snprintf(header.mode, sizeof(header.mode), "%07o", 0644);
+    snprintf(header.uid, sizeof(header.uid), "%07o", 0);
+    snprintf(header.gid, sizeof(header.gid), "%07o", 0);
+    snprintf(header.size, sizeof(header.size), "%011llo", (unsigned long long)len);
+    snprintf(header.mtime, sizeof(header.mtime), "%011llo", (unsigned long long)mtime);
+    header.type = type;
+    memcpy(header.magic, "ustar", 6);
+    memcpy(header.version, "00", 2);
+
+    // Checksum is calculated with the checksum field set to spaces
+    memset(header.checksum, ' ', sizeof(header.checksum));
+    unsigned int checksum = 0;
+    for (size_t i=0; i<sizeof(header); i++) {
+        checksum += ((unsigned char *)&header)[i];
+    }
+    snprintf(header.checksum, sizeof(header.checksum), "%06o", checksum);
+
+    if (fwrite(&header, sizeof(header), 1, fp) != 1) {
+        priv2::fail("Could not write tar archive");
+    }
+}
+
+void
+TarSink::write(const std::string &filename, const char *buf, size_t len)
+{
+    if (filename.size() > sizeof(TarHeader::name)) {
+        // Long filename: pax extended header with a "path" record, the
+        // record length includes the length of the number itself
+        std::string record = " path=" + filename + "\n";
+        size_t record_len = record.size();
+        while (std::to_string(record_len).size() + record.size() != record_len) {
+            record_len = std::to_string(record_len).size() + record.size();
+        }
+        record = std::to_string(record_len) + record;
+
+        write_header("././@PaxHeader", record.size(), 'x');
+        write_padded(record.data(), record.size());
+    }
+
+    write_header(filename, len, '0');
+    write_padded(buf, len);
+}
+
+void
+TarSink::close()
+{
+    if (!fp) {
+        return;
+    }
+
+    // End of archive: two zero blocks
+    static const char zeros[2 * TAR_BLOCK_SIZE] = {};
+    FILE *tmp = fp;
+    fp = nullptr;
+
+    bool ok = (fwrite(zeros, sizeof(zeros), 1, tmp) == 1);
+    if (tmp == stdout) {
+        ok = (fflush(tmp) == 0) && ok;
+    } else {
+        ok = (fclose(tmp) == 0) && ok;
+    }
+
+    if (!ok) {
+        priv2::fail("Could not write tar archive");
+    }
+}
+
+};
+};
@@ -0,0 +1,102 @@
+/*
+ * Privateer 2: The Darkening -- Data Dumper
+ * Copyright (c) 2016, 2017, Thomas Perl
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <time.h>
+#include <sys/types.h>
+
+#include <string>
+#include <unordered_set>
+
+namespace priv2 {
+namespace sink {
+
+/**
+ * Destination of the output files. All writes come from the output
+ * writer thread, one file at a time, in the order they were submitted.
+ **/
+struct Sink {
+    virtual ~Sink() {}
+
+    virtual void write(const std::string &filename, const char *buf, size_t len) = 0;
+    virtual void close() {}
+
+    /**
+     * Write a file with the <len> bytes at <offset> of the input file <fd>,
+     * which are also mapped at <buf>. Sinks that can copy between file
+     * descriptors override this, the default writes out <buf>.
+     **/
+    virtual void copy(const std::string &filename, int fd, off_t offset, const char *buf, size_t len)
+    {
+        write(filename, buf, len);
+    }
+
+    /**
+     * Make sure that all files written so far are on disk.
+     **/
+    virtual void sync() {}
+};
+
+/**
+ * Writes each output as a file (in the current directory). If <atomic>
+ * (--resume), files are written under a temporary name and renamed when
+ * complete, so a file with the final name is never partial.
+ **/
+struct DirectorySink : public Sink {
+    explicit DirectorySink(bool atomic=false);
+
+    virtual void write(const std::string &filename, const char *buf, size_t len);
+
+    // Clones the range (reflink) or copies it in the kernel if possible
+    virtual void copy(const std::string &filename, int fd, off_t offset, const char *buf, size_t len);
+
+    virtual void sync();
+
+private:
+    void make_parents(const std::string &filename);
+    std::string part_filename(const std::string &filename);
+    void commit(const std::string &tmp_filename, const std::string &filename);
+
+    bool atomic;
+
+    // Directories known to exist, so that each is created only once
+    std::unordered_set<std::string> directories;
+};
+
+/**
+ * Streams all outputs into a single tar archive, written to a file or to
+ * stdout (filename "-"), so no file is created per output.
+ **/
+struct TarSink : public Sink {
+    TarSink(const std::string &filename);
+    virtual ~TarSink();
+
+    virtual void write(const std::string &filename, const char *buf, size_t len);
+    virtual void close();
+
+private:
+    void write_header(const std::string &filename, size_t len, char type);
+    void write_padded(const char *buf, size_t len);
+
+    FILE *fp;
+    time_t mtime;
+};
+
+};
+};
@@ -0,0 +1,74 @@
+/*
+ * Privateer 2: The Darkening -- Data Dumper
+ * Copyright (c) 2016, 2017, Thomas Perl
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "stats.h"
+
+#include <vector>
+
+#include "log.h"
+
+namespace {
+
+std::vector<priv2::stats::Counter *> &
+counters()
+{
+    // Function-local, as counters register during static initialization
+    static std::vector<priv2::stats::Counter *> result;
+    return result;
+}
+
+}; // end anonymous namespace
+
+namespace priv2 {
+namespace stats {
+
+Counter::Counter(const char *name, enum Kind kind)
+    : name(name)
+    , kind(kind)
+    , value(0)
+    , peak(0)
+{
+    counters().push_back(this);
+}
+
+void
+Counter::add(int64_t delta)
+{
+    int64_t current = (value += delta);
+
+    if (kind == PEAK) {
+        int64_t previous = peak;
+        while (current > previous && !peak.compare_exchange_weak(previous, current)) {
+        }
+    }
+}
+
+void
+report()
+{
+    priv2::log::message(priv2::log::QUIET, "\n== Statistics ==\n");
+    for (auto &counter: counters()) {
+        if (counter->kind == Counter::PEAK) {
+            priv2::log::message(priv2::log::QUIET, "%-40s %12lld (peak)\n", counter->name, (long long)counter->peak);
+        } else {
+            priv2::log::message(priv2::log::QUIET, "%-40s %12lld\n", counter->name, (long long)counter->value);
+        }
+    }
+}
+
+};
+};
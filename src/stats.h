@@ -0,0 +1,53 @@
+/*
+ * Privateer 2: The Darkening -- Data Dumper
+ * Copyright (c) 2016, 2017, Thomas Perl
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+
+namespace priv2 {
+namespace stats {
+
+/**
+ * A named number for the statistics report (--stats). Counters are
+ * defined as static objects next to the code that updates them, and
+ * register themselves for the report on construction.
+ **/
+struct Counter {
+    enum Kind {
+        TOTAL = 0, // sum of all updates
+        PEAK = 1, // current value, reported as the highest it has been
+    };
+
+    Counter(const char *name, enum Kind kind=TOTAL);
+
+    void add(int64_t delta);
+
+    const char *name;
+    enum Kind kind;
+    std::atomic<int64_t> value;
+    std::atomic<int64_t> peak;
+};
+
+/**
+ * Print all counters to the console.
+ **/
+void report();
+
+};
+};
@@ -0,0 +1,329 @@
+/*
+ * Privateer 2: The Darkening -- Data Dumper
+ * Copyright (c) 2016, 2017, Thomas Perl
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "task.h"
+#include "log.h"
+#include "cache.h"
+#include "unit.h"
+#include "memory.h"
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <memory>
+#include <condition_variable>
+
+namespace {
+
+struct Task {
+    Task(std::function<void()> &&fn, priv2::task::Group *group, priv2::log::Buffer *log,
+            priv2::cache::Recorder *recorder, priv2::unit::Unit *unit, size_t memory)
+        : fn(std::move(fn))
+        , group(group)
+        , log(log)
+        , recorder(recorder)
+        , unit(unit)
+        , memory(memory)
+    {
+    }
+
+    std::function<void()> fn;
+    priv2::task::Group *group;
+    priv2::log::Buffer *log;
+    priv2::cache::Recorder *recorder;
+    priv2::unit::Unit *unit;
+    size_t memory;
+};
+
+struct Worker {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+};
+
+struct Scheduler {
+    Scheduler() : workers(), injected(), threads(), mutex(), cv(), queued(0), stopping(false), generation(0), sleeping(0) {}
+
+    void push(Task &&task);
+    bool run_one(bool force=false);
+    void run(Task &task);
+    bool sleep(std::unique_lock<std::mutex> &lock, uint64_t seen, const std::function<bool()> &done);
+    void loop(int index);
+
+    // per-thread queues; tasks spawned outside of a worker go into "injected"
+    std::vector<std::unique_ptr<Worker>> workers;
+    Worker injected;
+    std::vector<std::thread> threads;
+
+    // used for sleeping when there is nothing to do
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::atomic<int> queued;
+    bool stopping;
+
+    // Changed (with the mutex held) when a task is pushed or memory is
+    // released, so that workers can check if they might be able to run
+    // a task that they could not run before
+    std::atomic<uint64_t> generation;
+
+    // Workers sleeping (in the loop or in Group::wait)
+    int sleeping;
+};
+
+Scheduler *
+scheduler = nullptr;
+
+thread_local int
+worker_index = -1;
+
+/**
+ * Take the newest or oldest task of <worker> whose memory can be reserved
+ * (--mem-limit), or the newest or oldest task regardless of the memory
+ * limit with <force>. Tasks that do not fit stay in the queue.
+ **/
+bool
+take(Worker &worker, bool newest, bool force, std::function<void(Task &&)> consume)
+{
+    std::unique_lock<std::mutex> lock(worker.mutex);
+
+    size_t count = worker.tasks.size();
+    for (size_t i=0; i<count; i++) {
+        auto it = newest ? (worker.tasks.end() - 1 - i) : (worker.tasks.begin() + i);
+        if (force) {
+            priv2::memory::reserve(it->memory);
+        } else if (!priv2::memory::try_reserve(it->memory)) {
+            continue;
+        }
+
+        Task task = std::move(*it);
+        worker.tasks.erase(it);
+        lock.unlock();
+
+        consume(std::move(task));
+        return true;
+    }
+
+    return false;
+}
+
+void
+Scheduler::push(Task &&task)
+{
+    Worker &worker = (worker_index == -1) ? injected : *workers[worker_index];
+    {
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.tasks.emplace_back(std::move(task));
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queued++;
+        generation++;
+    }
+    cv.notify_all();
+}
+
+void
+Scheduler::run(Task &task)
+{
+    queued--;
+
+    priv2::log::Buffer *previous = priv2::log::swap(task.log);
+    priv2::cache::Recorder *previous_recorder = priv2::cache::swap(task.recorder);
+    // Reserved when the task was taken from its queue
+    priv2::unit::run_task(task.unit, task.fn);
+    priv2::memory::release(task.memory);
+    priv2::cache::swap(previous_recorder);
+    priv2::log::swap(previous);
+
+    bool released = (task.memory != 0);
+    if (--task.group->pending == 0 || released) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (released) {
+            generation++;
+        }
+        cv.notify_all();
+    }
+}
+
+bool
+Scheduler::run_one(bool force)
+{
+    auto consume = [this] (Task &&task) { run(task); };
+
+    // Own tasks first (depth-first), then work from outside, then steal
+    if (worker_index != -1 && take(*workers[worker_index], true, force, consume)) {
+        return true;
+    }
+
+    if (take(injected, false, force, consume)) {
+        return true;
+    }
+
+    size_t n = workers.size();
+    for (size_t i=1; i<n; i++) {
+        if (take(*workers[(worker_index + i) % n], false, force, consume)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Sleep until a task has been pushed or memory has been released since
+ * generation <seen>, or until <done>. Returns true instead if the calling
+ * worker has to run a task regardless of the memory limit: when tasks are
+ * queued that do not fit, and all other workers are sleeping, nobody is
+ * left to release memory.
+ **/
+bool
+Scheduler::sleep(std::unique_lock<std::mutex> &lock, uint64_t seen, const std::function<bool()> &done)
+{
+    if (queued > 0 && generation == seen && sleeping == (int)workers.size() - 1) {
+        return true;
+    }
+
+    sleeping++;
+    cv.wait(lock, [this, seen, &done] () { return generation != seen || stopping || done(); });
+    sleeping--;
+    return false;
+}
+
+void
+Scheduler::loop(int index)
+{
+    worker_index = index;
+
+    while (true) {
+        uint64_t seen = generation;
+        if (run_one()) {
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        if (stopping) {
+            break;
+        }
+
+        if (sleep(lock, seen, [] () { return false; })) {
+            lock.unlock();
+            run_one(true);
+        }
+    }
+}
+
+}; // end anonymous namespace
+
+namespace priv2 {
+namespace task {
+
+void
+start(int workers)
+{
+    scheduler = new Scheduler();
+
+    if (workers == 1) {
+        return;
+    }
+
+    for (int i=0; i<workers; i++) {
+        scheduler->workers.emplace_back(new Worker());
+    }
+
+    for (int i=0; i<workers; i++) {
+        scheduler->threads.emplace_back([i] () { scheduler->loop(i); });
+    }
+}
+
+void
+stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(scheduler->mutex);
+        scheduler->stopping = true;
+    }
+    scheduler->cv.notify_all();
+
+    for (auto &thread: scheduler->threads) {
+        thread.join();
+    }
+
+    delete scheduler;
+    scheduler = nullptr;
+}
+
+Group::Group()
+    : pending(0)
+{
+}
+
+Group::~Group()
+{
+    wait();
+}
+
+void
+Group::spawn(std::function<void()> fn, size_t memory)
+{
+    if (scheduler->workers.empty()) {
+        fn();
+        return;
+    }
+
+    // Output of the task goes where it would have gone in a serial run
+    priv2::log::Buffer *log = priv2::log::current();
+    if (log) {
+        log = log->fork();
+    }
+
+    // Outputs of the task belong to the decoder that spawned it
+    priv2::cache::Recorder *recorder = priv2::cache::current();
+
+    // Failures of the task are failures of the unit that spawned it
+    priv2::unit::Unit *unit = priv2::unit::current();
+
+    pending++;
+    scheduler->push(Task(std::move(fn), this, log, recorder, unit, memory));
+}
+
+void
+Group::wait()
+{
+    while (pending > 0) {
+        if (worker_index == -1) {
+            std::unique_lock<std::mutex> lock(scheduler->mutex);
+            scheduler->cv.wait(lock, [this] () { return pending == 0; });
+            continue;
+        }
+
+        uint64_t seen = scheduler->generation;
+        if (scheduler->run_one()) {
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(scheduler->mutex);
+        if (scheduler->sleep(lock, seen, [this] () { return pending == 0; })) {
+            lock.unlock();
+            scheduler->run_one(true);
+        }
+    }
+}
+
+};
+};
@@ -0,0 +1,59 @@
+/*
+ * Privateer 2: The Darkening -- Data Dumper
+ * Copyright (c) 2016, 2017, Thomas Perl
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <functional>
+
+#include <cstddef>
+
+namespace priv2 {
+namespace task {
+
+/**
+ * Start the work-stealing scheduler with the given number of worker
+ * threads. With a single worker, tasks run inline when they are spawned,
+ * which keeps the behaviour (and output order) of a serial run.
+ **/
+void start(int workers);
+
+/**
+ * Wait for the worker threads to finish and shut down the scheduler.
+ **/
+void stop();
+
+/**
+ * A set of tasks that can be waited for. Tasks spawned from a worker are
+ * pushed to that worker's own queue and taken from there (newest first),
+ * idle workers steal the oldest tasks from the other queues. A worker
+ * waiting for a group keeps running tasks in the meantime, so nested
+ * groups (BIG entries -> IFF forms -> chunks) never block a thread.
+ **/
+struct Group {
+    Group();
+    ~Group();
+
+    // <memory> is the estimated peak memory use of the task (--mem-limit)
+    void spawn(std::function<void()> fn, size_t memory=0);
+    void wait();
+
+    std::atomic<int> pending;
+};
+
+};
+};
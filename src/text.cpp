@@ -27,46 +27,51 @@
 
 #include "priv2.h"
 #include "codepoint.h"
+#include "kernel.h"
 
 namespace priv2 {
 namespace text {
 
-std::vector<std::string>
-decode(const char *buf, size_t len)
+bool
+decode(const char *buf, size_t len, std::vector<std::string> &result)
 {
     uint32_t *read_ptr = (uint32_t *)buf;
 
     uint32_t offset = *read_ptr;
     if (offset % 4 != 0) {
-        priv2::fail("Expected offset divisible by 4");
+        return priv2::fail("Expected offset divisible by 4");
     }
 
+    const char *end = buf + len;
     uint32_t n_items = offset / 4;
-    std::vector<std::string> result;
     for (int i=0; i<n_items; i++) {
         offset = *read_ptr++;
         const char *msg = buf + offset;
 
-        std::vector<char> charbuf;
-        while (*msg) {
-            uint8_t codepoint = *msg;
+        // Built in place, without a temporary buffer
+        result.emplace_back();
+        auto &line = result.back();
+        while (msg < end && *msg) {
+            // Plain ASCII is copied in one piece
+            size_t run = priv2::kernel::printable_run(msg, end - msg);
+            line.append(msg, run);
+            msg += run;
+            if (msg == end || !*msg) {
+                break;
+            }
 
-            if (codepoint > 31 && codepoint < 127) {
-                charbuf.push_back(codepoint);
+            uint8_t codepoint = *msg;
+            const char *codepoint_utf8 = priv2::codepoint::get_utf8(codepoint);
+            if (codepoint_utf8) {
+                line += codepoint_utf8;
             } else {
-                const char *codepoint_utf8 = priv2::codepoint::get_utf8(codepoint);
-                std::string tmp = codepoint_utf8 ? codepoint_utf8 : priv2::format("<0x%x>", codepoint);
-                for (auto c: tmp) {
-                    charbuf.push_back(c);
-                }
+                line += priv2::format("<0x%x>", codepoint);
             }
 
             msg++;
         }
-
-        result.emplace_back(charbuf.data(), charbuf.size());
     }
-    return result;
+    return true;
 }
 
 };
@@ -23,7 +23,7 @@
 namespace priv2 {
 namespace text {
 
-std::vector<std::string> decode(const char *buf, size_t len);
+bool decode(const char *buf, size_t len, std::vector<std::string> &result);
 
 };
 };
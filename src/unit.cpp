@@ -0,0 +1,182 @@
+/*
+ * Privateer 2: The Darkening -- Data Dumper
+ * Copyright (c) 2016, 2017, Thomas Perl
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "unit.h"
+#include "priv2.h"
+#include "log.h"
+#include "stats.h"
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+namespace priv2 {
+namespace unit {
+
+struct Unit {
+    // Unit that was running on this thread before this one
+    Unit *previous;
+
+    // Unit a failure is recorded for: this one, or the one that spawned the task
+    Unit *owner;
+
+    // Unit this one is a part of (possibly running on another thread)
+    Unit *parent;
+
+    const priv2::path::Path *path;
+    uint32_t offset;
+    std::atomic<bool> failed;
+
+    // Set once the code running in this frame failed, it is on its way back
+    bool abandoned;
+};
+
+};
+};
+
+namespace {
+
+struct Failure {
+    std::string path;
+    uint32_t offset;
+    std::string reason;
+};
+
+thread_local priv2::unit::Unit *
+current_unit = nullptr;
+
+std::mutex
+failures_mutex;
+
+std::vector<Failure>
+failures;
+
+priv2::stats::Counter
+units_failed("Work units failed");
+
+void
+guard(priv2::unit::Unit &unit, const std::function<void()> &fn)
+{
+    unit.previous = current_unit;
+    unit.failed = false;
+    unit.abandoned = false;
+    current_unit = &unit;
+
+    fn();
+
+    current_unit = unit.previous;
+}
+
+}; // end anonymous namespace
+
+namespace priv2 {
+namespace unit {
+
+bool
+run(const priv2::path::Path &path, uint32_t offset, std::function<void()> fn)
+{
+    Unit unit;
+    unit.owner = &unit;
+    unit.parent = current();
+    unit.path = &path;
+    unit.offset = offset;
+    guard(unit, fn);
+    return !unit.failed;
+}
+
+Unit *
+current()
+{
+    return current_unit ? current_unit->owner : nullptr;
+}
+
+void
+run_task(Unit *owner, const std::function<void()> &fn)
+{
+    // Always a frame of its own, so that a failure of the task is never
+    // recorded for the unit the worker thread happened to be waiting in
+    Unit unit;
+    unit.owner = owner;
+    unit.parent = nullptr;
+    unit.path = nullptr;
+    unit.offset = 0;
+    guard(unit, fn);
+}
+
+bool
+failed()
+{
+    return current_unit && current_unit->owner && current_unit->owner->failed;
+}
+
+bool
+abandon(const char *message)
+{
+    Unit *unit = current_unit;
+    if (!unit || !unit->owner) {
+        return false;
+    }
+
+    // The code may check more before it returns, only its first failure counts
+    if (unit->abandoned) {
+        return true;
+    }
+    unit->abandoned = true;
+
+    // The units it is a part of are not finished either
+    Unit *owner = unit->owner;
+    for (Unit *u = owner; u; u = u->parent) {
+        u->failed = true;
+    }
+    units_failed.add(1);
+
+    Failure failure { owner->path->str(), owner->offset, message };
+    priv2::log::warning("Failed: '%s' at offset 0x%08x: %s\n",
+            failure.path.c_str(), failure.offset, message);
+    {
+        std::lock_guard<std::mutex> lock(failures_mutex);
+        failures.emplace_back(std::move(failure));
+    }
+
+    return true;
+}
+
+size_t
+report()
+{
+    std::lock_guard<std::mutex> lock(failures_mutex);
+    if (failures.empty()) {
+        return 0;
+    }
+
+    // Workers fail in any order, the report is the same for every run
+    std::sort(failures.begin(), failures.end(), [] (const Failure &a, const Failure &b) {
+        return (a.path != b.path) ? (a.path < b.path) : (a.offset < b.offset);
+    });
+
+    priv2::log::message(priv2::log::QUIET, "\n%zu work unit(s) failed:\n", failures.size());
+    for (auto &failure: failures) {
+        priv2::log::message(priv2::log::QUIET, " - %s (offset 0x%08x): %s\n",
+                failure.path.c_str(), failure.offset, failure.reason.c_str());
+    }
+
+    return failures.size();
+}
+
+};
+};
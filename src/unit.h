@@ -0,0 +1,72 @@
+/*
+ * Privateer 2: The Darkening -- Data Dumper
+ * Copyright (c) 2016, 2017, Thomas Perl
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+#pragma once
+
+#include <cstdint>
+#include <functional>
+
+#include "path.h"
+
+namespace priv2 {
+namespace unit {
+
+/**
+ * A work unit that is running (an input file, a BIG entry, an IFF chunk
+ * or a complete form). Failures end the unit and are reported at the end.
+ **/
+struct Unit;
+
+/**
+ * Run <fn> as the work unit at <offset> of <path>. If priv2::fail() is
+ * called while it runs, the failure is recorded, and the code returns
+ * false up to <fn> (which returns early). Returns false if the unit, or
+ * any part of it, failed.
+ **/
+bool run(const priv2::path::Path &path, uint32_t offset, std::function<void()> fn);
+
+/**
+ * Get the unit running on the calling thread, or nullptr.
+ **/
+Unit *current();
+
+/**
+ * Run a task that was spawned from <unit> on another thread. If the task
+ * fails, <unit> is recorded as failed.
+ **/
+void run_task(Unit *unit, const std::function<void()> &fn);
+
+/**
+ * Check if the current unit (or any part of it) has failed, so that it
+ * does not get recorded as finished.
+ **/
+bool failed();
+
+/**
+ * Record that the current unit is abandoned for the given reason (only the
+ * first reason of the code running on the calling thread is recorded).
+ * Returns false if no unit is running on the calling thread.
+ **/
+bool abandon(const char *message);
+
+/**
+ * Print the failed units (path, offset and reason), and return how many
+ * there were.
+ **/
+size_t report();
+
+};
+};
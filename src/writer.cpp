@@ -0,0 +1,153 @@
+/*
+ * Privateer 2: The Darkening -- Data Dumper
+ * Copyright (c) 2016, 2017, Thomas Perl
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "writer.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdarg>
+
+#include "output.h"
+
+namespace {
+
+// Enough for most text outputs without growing
+constexpr size_t INITIAL_SIZE = 4096;
+
+}; // end anonymous namespace
+
+namespace priv2 {
+namespace writer {
+
+Writer::Writer()
+    : buf()
+{
+    buf.reserve(INITIAL_SIZE);
+}
+
+Writer &
+Writer::str(const char *s)
+{
+    buf.insert(buf.end(), s, s + strlen(s));
+    return *this;
+}
+
+Writer &
+Writer::str(const std::string &s)
+{
+    buf.insert(buf.end(), s.begin(), s.end());
+    return *this;
+}
+
+Writer &
+Writer::chr(char c)
+{
+    buf.push_back(c);
+    return *this;
+}
+
+Writer &
+Writer::dec(int64_t value)
+{
+    char tmp[20];
+    char *end = tmp + sizeof(tmp);
+    char *pos = end;
+
+    // Negated as unsigned, so that INT64_MIN works too
+    uint64_t magnitude = (value < 0) ? -(uint64_t)value : value;
+    do {
+        *--pos = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while (magnitude != 0);
+
+    if (value < 0) {
+        buf.push_back('-');
+    }
+
+    buf.insert(buf.end(), pos, end);
+    return *this;
+}
+
+Writer &
+Writer::hex(uint32_t value, int digits)
+{
+    static const char *DIGITS = "0123456789abcdef";
+
+    char tmp[8];
+    char *end = tmp + sizeof(tmp);
+    char *pos = end;
+    do {
+        *--pos = DIGITS[value & 0xF];
+        value >>= 4;
+    } while (value != 0);
+
+    for (int i=end-pos; i<digits; i++) {
+        buf.push_back('0');
+    }
+
+    buf.insert(buf.end(), pos, end);
+    return *this;
+}
+
+Writer &
+Writer::fixed(double value, int precision)
+{
+    char tmp[64];
+    int len = snprintf(tmp, sizeof(tmp), "%.*f", precision, value);
+    if (len < (int)sizeof(tmp)) {
+        buf.insert(buf.end(), tmp, tmp + len);
+    } else {
+        // Huge values, formatted directly into the buffer
+        size_t pos = buf.size();
+        buf.resize(pos + len + 1);
+        snprintf(buf.data() + pos, len + 1, "%.*f", precision, value);
+        buf.resize(pos + len);
+    }
+
+    return *this;
+}
+
+std::string
+Writer::string() const
+{
+    return std::string(buf.data(), buf.size());
+}
+
+void
+Writer::write_file(const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    vwrite_file(fmt, ap);
+    va_end(ap);
+}
+
+void
+Writer::vwrite_file(const char *fmt, va_list ap)
+{
+    char *filename;
+    vasprintf(&filename, fmt, ap);
+
+    priv2::output::submit(filename, std::move(buf));
+    free(filename);
+
+    buf = std::vector<char>();
+}
+
+};
+};
@@ -0,0 +1,65 @@
+/*
+ * Privateer 2: The Darkening -- Data Dumper
+ * Copyright (c) 2016, 2017, Thomas Perl
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstdarg>
+#include <string>
+#include <vector>
+
+namespace priv2 {
+namespace writer {
+
+/**
+ * Text output (e.g. OBJ, MTL, TXT files) built by appending to a single
+ * buffer, without formatting each line into a string of its own. Integers
+ * are formatted by hand; floats use snprintf() on the stack, as C++14 has
+ * no std::to_chars. The buffer is handed to the output queue as is.
+ **/
+class Writer {
+public:
+    Writer();
+
+    Writer &str(const char *s);
+    Writer &str(const std::string &s);
+    Writer &chr(char c);
+
+    // Decimal, like "%d"
+    Writer &dec(int64_t value);
+
+    // Lower case hex digits padded with zeros, like "%0<digits>x"
+    Writer &hex(uint32_t value, int digits);
+
+    // Like "%.<precision>f"
+    Writer &fixed(double value, int precision);
+
+    size_t size() const { return buf.size(); }
+
+    // Contents as a string, for callers that need one
+    std::string string() const;
+
+    // Submit the contents as output file, the writer is empty afterwards
+    void write_file(const char *fmt, ...);
+    void vwrite_file(const char *fmt, va_list ap);
+
+private:
+    std::vector<char> buf;
+};
+
+};
+};